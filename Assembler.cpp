@@ -5,29 +5,119 @@
 
 #include <algorithm>
 #include <bitset>
-#include <cctype>
 #include <fstream>
 #include <iostream>
 #include <string>
 
+namespace {
+
+// Mnemonics and registers are looked up in a table without collisions: the hash of every keyword selects its own
+// slot, and the name stored there confirms the match. Commands are indices into CAssembler::commands,
+// registers are their addresses.
+struct CKeyword {
+	std::string_view Name;
+	int Command;
+	unsigned Register;
+};
+
+constexpr CKeyword keywords[] = {
+	{ "print", 0, 0 }, { "read", 1, 0 }, { "push", 2, 0 }, { "pop", 3, 0 }, { "move", 4, 0 }, { "if", 5, 0 },
+	{ "call", 6, 0 }, { "equal", 7, 0 }, { "add", 8, 0 }, { "subtract", 9, 0 }, { "pushaddr", 10, 0 },
+	{ "return", 11, 0 }, { "exit", 12, 0 }, { "str", 13, 0 }, { "label", 14, 0 },
+	{ "reg1", -1, 2 }, { "reg2", -1, 3 }, { "reg3", -1, 4 }, { "reg4", -1, 5 }, { "reg5", -1, 6 },
+	{ "reg6", -1, 7 }, { "reg7", -1, 8 }, { "res", -1, 9 }
+};
+
+const unsigned keywordSlotsCount = 32;
+
+constexpr unsigned getKeywordHash( std::string_view name )
+{
+	return name.empty() ? 0 : ( static_cast<unsigned>( name.length() ) * 10
+		+ static_cast<unsigned char>( name[0] ) * 28 + static_cast<unsigned char>( name[name.length() - 1] ) * 9
+		+ static_cast<unsigned char>( name[name.length() / 2] ) ) % keywordSlotsCount;
+}
+
+struct CKeywordTable {
+	CKeyword Slots[keywordSlotsCount];
+	bool IsPerfect;
+};
+
+constexpr CKeywordTable buildKeywordTable()
+{
+	CKeywordTable table{ {}, true };
+	for( const CKeyword& keyword : keywords ) {
+		CKeyword& slot = table.Slots[getKeywordHash( keyword.Name )];
+		table.IsPerfect = table.IsPerfect && slot.Name.empty();
+		slot = keyword;
+	}
+	return table;
+}
+
+constexpr CKeywordTable keywordTable = buildKeywordTable();
+static_assert( keywordTable.IsPerfect, "Keywords collide in the hash table." );
+
+const CKeyword* findKeyword( std::string_view name )
+{
+	const CKeyword& slot = keywordTable.Slots[getKeywordHash( name )];
+	return slot.Name == name && !name.empty() ? &slot : nullptr;
+}
+
+} // namespace
+
+void ( CAssembler::* const CAssembler::commands[] )() = {
+	&CAssembler::doPrint, &CAssembler::doRead, &CAssembler::doPush, &CAssembler::doPop, &CAssembler::doMove,
+	&CAssembler::doIf, &CAssembler::doCall, &CAssembler::doEqual, &CAssembler::doAdd, &CAssembler::doSubtract,
+	&CAssembler::doPushaddr, &CAssembler::doReturn, &CAssembler::doExit, &CAssembler::doStr, &CAssembler::doLabel
+};
+
 CAssembler::CAssembler()
 {
 }
 
-void CAssembler::Assembly( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile )
+void CAssembler::Assembly( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile,
+	const CAssemblerOptions& _options )
 {
-	readProgram( pathToAssemblerFile );
+	options = _options;
+	checkMemorySize();
+	optimizer = COptimizer();
+	// Names of a failed assembly would point into its closed source.
+	clear();
+	lexer.Open( pathToAssemblerFile );
+	readProgram();
 	writeBytes( pathToBinaryFile );
 	clear();
 }
 
-void CAssembler::readProgram( const std::string& pathToAssemblerFile )
+std::vector<unsigned> CAssembler::AssemblySource( std::string_view source, const CAssemblerOptions& _options )
+{
+	options = _options;
+	checkMemorySize();
+	optimizer = COptimizer();
+	clear();
+	lexer.OpenSource( source );
+	readProgram();
+	std::vector<unsigned> words = getBytes();
+	clear();
+	return words;
+}
+
+// Statistics of the optimizer for the last assembled program.
+const COptimizer& CAssembler::GetOptimizer() const
+{
+	return optimizer;
+}
+
+void CAssembler::checkMemorySize() const
 {
-	input = std::ifstream( pathToAssemblerFile, std::ios::in );
-	if( !input.is_open() ) {
-		throw CInvalidFile( "CAssembler::readProgram::InvalidFile - Cannot open assembler file." );
+	if( options.MemorySize < registersCount + 2 + minStackSize || options.MemorySize > CImage::MaxMemorySize ) {
+		throw CInvalidArguments( "CAssembler::checkMemorySize::InvalidArguments - Memory size must be from "
+			+ std::to_string( registersCount + 2 + minStackSize ) + " to " + std::to_string( CImage::MaxMemorySize )
+			+ " words." );
 	}
+}
 
+void CAssembler::readProgram()
+{
 	initCode();
 	readStrings();
 	readLabels();
@@ -39,109 +129,91 @@ void CAssembler::readProgram( const std::string& pathToAssemblerFile )
 
 void CAssembler::initCode()
 {
-	for( int i = 0; i < memoryLimit; ++i ) {
-		code[i] = 0;
-	}
-	for( int i = 1; i <= registersCount - 1; ++i ) {
-		registers["reg" + std::to_string( i )] = i + 1;
-		code[i + 1] = integerShift;
-	}
-	registers["res"] = registersCount + 1;
-	code[registersCount + 1] = integerShift;
-	current = registersCount + 2;
-
-	commands = {
-		{ "print", std::bind( &CAssembler::doPrint, this ) },
-		{ "read", std::bind( &CAssembler::doRead, this ) },
-		{ "push", std::bind( &CAssembler::doPush, this ) },
-		{ "pop", std::bind( &CAssembler::doPop, this ) },
-		{ "move", std::bind( &CAssembler::doMove, this ) },
-		{ "if", std::bind( &CAssembler::doIf, this ) },
-		{ "call", std::bind( &CAssembler::doCall, this ) },
-		{ "equal", std::bind( &CAssembler::doEqual, this ) },
-		{ "add", std::bind( &CAssembler::doAdd, this ) },
-		{ "subtract", std::bind( &CAssembler::doSubtract, this ) },
-		{ "pushaddr", std::bind( &CAssembler::doPushaddr, this ) },
-		{ "return", std::bind( &CAssembler::doReturn, this ) },
-		{ "exit", std::bind( &CAssembler::doExit, this ) },
-		{ "label", std::bind( &CAssembler::doLabel, this ) },
-		{ "str", std::bind( &CAssembler::doStr, this ) },
-	};
+	allocate( registersCount + 2 );
+	for( int i = 2; i <= registersCount + 1; ++i ) {
+		code[i] = integerShift;
+	}
+	sections = { CSection{ CImage::RegistersSection, 0, 0 } };
 }
 
 void CAssembler::readStrings()
 {
 	readAndCheckKeyword( "strings" );
-	for( input >> token; token != "."; input >> token ) {
+	beginSection( CImage::StringsSection );
+	for( token = lexer.Next(); token != "."; token = lexer.Next() ) {
 		checkStringDoubleDefinition( token );
-		strings[token] = current;
+		setSymbolAddress( CImage::StringSymbol, token, current );
 
-		std::string string;
-		input.get();
-		std::getline( input, string );
+		const std::string_view string = lexer.RestOfLine();
+		const unsigned address = allocate( static_cast<unsigned>( ( string.length() + 3 ) / 4 + 1 ) );
 
 		for( int i = 0; i < string.length(); ++i ) {
-			code[current + i / 4] += static_cast<unsigned>( string[i] ) << ( 24 - 8 * ( i % 4 ) );
+			code[address + i / 4] += static_cast<unsigned>( string[i] ) << ( 24 - 8 * ( i % 4 ) );
 		}
-
-		current += ( string.length() - 1 ) / 4 + 2;
 	}
-	code[current++] = 0;
+	emit( 0 );
 }
 
-void CAssembler::readAndCheckKeyword( const std::string keyword )
+void CAssembler::readAndCheckKeyword( std::string_view keyword )
 {
-	input >> token;
+	token = lexer.Next();
 	if( token != keyword ) {
-		throw CSyntaxError( "CAssembler::readAndCheckKeyword::SyntaxError - Expected '" + keyword + "', but '" + token + "' found." );
+		throw CSyntaxError( "CAssembler::readAndCheckKeyword::SyntaxError - Expected '" + std::string( keyword )
+			+ "', but '" + std::string( token ) + "' found" + getPosition() + "." );
 	}
 }
 
-void CAssembler::checkStringDoubleDefinition( const std::string token ) const
+void CAssembler::checkStringDoubleDefinition( std::string_view token ) const
 {
-	if( strings.find( token ) != strings.end() ) {
-		throw CSyntaxError( "CAssembler::checkFunctionDoubleDefinition::SyntaxError - String '" + token + "' already defined." );
+	if( getSymbolAddress( CImage::StringSymbol, token ) != noAddress ) {
+		throw CSyntaxError( "CAssembler::checkFunctionDoubleDefinition::SyntaxError - String '" + std::string( token )
+			+ "' already defined" + getPosition() + "." );
 	}
 }
 
 void CAssembler::readLabels()
 {
 	readAndCheckKeyword( "labels" );
-	for( input >> token; token != "."; input >> token ) {
+	beginSection( CImage::LabelsSection );
+	for( token = lexer.Next(); token != "."; token = lexer.Next() ) {
 		checkLabelDoubleDeclaration( token );
-		labels[token] = current++;
+		setSymbolAddress( CImage::LabelSymbol, token, allocate( 1 ) );
 	}
-	code[current++] = 0;
+	emit( 0 );
 }
 
 
-void CAssembler::checkLabelDoubleDeclaration( const std::string token ) const
+void CAssembler::checkLabelDoubleDeclaration( std::string_view token ) const
 {
-	if( labels.find( token ) != labels.end() ) {
-		throw CSyntaxError( "CAssembler::checkLabelDoubleDeclaration::SyntaxError - Label + '" + token + "' already declarated." );
+	if( getSymbolAddress( CImage::LabelSymbol, token ) != noAddress ) {
+		throw CSyntaxError( "CAssembler::checkLabelDoubleDeclaration::SyntaxError - Label + '" + std::string( token )
+			+ "' already declarated" + getPosition() + "." );
 	}
 }
 
 void CAssembler::readFunctions()
 {
 	readAndCheckKeyword( "functions" );
-	for( input >> token; token != "."; input >> token ) {
+	for( token = lexer.Next(); token != "."; token = lexer.Next() ) {
 		checkFunctionDoubleDefinition( token );
-		functions[token] = current++;
+		beginSection( CImage::FunctionsSection );
+		setSymbolAddress( CImage::FunctionSymbol, token, allocate( 1 ) );
 		readFunction( token );
 	}
-	code[current++] = 0;
+	beginSection( CImage::FunctionsSection );
+	emit( 0 );
 }
 
 
-void CAssembler::checkFunctionDoubleDefinition( const std::string token ) const
+void CAssembler::checkFunctionDoubleDefinition( std::string_view token ) const
 {
-	if( functions.find( token ) != functions.end() ) {
-		throw CSyntaxError( "CAssembler::checkFunctionDoubleDefinition::SyntaxError - Function '" + token + "' already defined." );
+	if( getSymbolAddress( CImage::FunctionSymbol, token ) != noAddress ) {
+		throw CSyntaxError( "CAssembler::checkFunctionDoubleDefinition::SyntaxError - Function '" + std::string( token )
+			+ "' already defined" + getPosition() + "." );
 	}
 }
 
-void CAssembler::readFunction( const std::string name )
+void CAssembler::readFunction( std::string_view name )
 {
 	readStrings();
 	readLabels();
@@ -151,239 +223,423 @@ void CAssembler::readFunction( const std::string name )
 }
 
 
-void CAssembler::setFunction( const std::string name )
+void CAssembler::setFunction( std::string_view name )
 {
-	code[functions.at( name )] = current;
+	code[getSymbolAddress( CImage::FunctionSymbol, name )] = current;
 }
 
 void CAssembler::readCommands()
 {
 	readAndCheckKeyword( "commands" );
-	for( input >> token; token != "."; input >> token ) {
-		if( commands.find( token ) == commands.end() ) {
-			throw CSyntaxError( "CAssembler::readCommands::SyntaxError - Unknown command '" + token + "'." );
+	beginSection( CImage::CodeSection );
+	const unsigned begin = current;
+	labelDefinitions.clear();
+	for( token = lexer.Next(); token != "."; token = lexer.Next() ) {
+		const CKeyword* keyword = findKeyword( token );
+		if( keyword == nullptr || keyword->Command < 0 ) {
+			throw CSyntaxError( "CAssembler::readCommands::SyntaxError - Unknown command '" + std::string( token )
+				+ "'" + getPosition() + "." );
+		}
+		( this->*commands[keyword->Command] )();
+	}
+	if( options.Optimize ) {
+		optimizeCommands( begin );
+	}
+	emit( integerShift - 1 );
+}
+
+// Takes back the commands assembled from begin and emits them again as the optimizer leaves them. Labels
+// defined among them go along with the commands they precede.
+void CAssembler::optimizeCommands( unsigned begin )
+{
+	std::vector<CIrCommand> commands;
+	auto label = labelDefinitions.begin();
+	for( unsigned address = begin; address <= current; address += 3 ) {
+		for( ; label != labelDefinitions.end() && label->second == address; ++label ) {
+			commands.push_back( CIrCommand{ COptimizer::Label, label->first, 0, false, false } );
+		}
+		if( address < current ) {
+			commands.push_back( CIrCommand{ code[address], code[address + 1], code[address + 2], false, false } );
+		}
+	}
+	optimizer.Optimize( commands );
+
+	current = begin;
+	code.resize( current );
+	for( const CIrCommand& command : commands ) {
+		if( command.Command == COptimizer::Label ) {
+			code[command.Argument1] = current;
+		} else {
+			emit( command.Command );
+			emit( command.Argument1 );
+			emit( command.Argument2 );
 		}
-		commands[token]();
 	}
-	code[current++] = integerShift - 1;
 }
 
 void CAssembler::doPrint()
 {
-	code[current++] = 0;
-	code[current++] = getIntegerOrRegister();
-	code[current++] = 0;
+	emit( 0 );
+	emit( getIntegerOrRegister() );
+	emit( 0 );
 }
 
 unsigned CAssembler::getIntegerOrRegister()
 {
-	input >> token;
+	token = lexer.Next();
 	if( isInteger( token ) ) {
 		return getInteger( token );
 	}
 	return getRegister( token );
 }
 
-bool CAssembler::isInteger( const std::string token )
+bool CAssembler::isInteger( std::string_view token )
 {
 	return !token.empty() && ( std::find_if( token.begin(), token.end(),
 		[] ( char c )
 	{
-		return !std::isdigit( c );
+		return c < '0' || c > '9';
 	} ) == token.end() );
 }
 
-unsigned CAssembler::getInteger( const std::string token )
+// Digits are accumulated only while the value may still fit, so any longer number is reported as too large.
+unsigned CAssembler::getInteger( std::string_view token )
 {
 	checkInteger( token );
-	unsigned value = std::atoi( token.c_str() );
+	unsigned long long value = 0;
+	for( auto c = token.begin(); c != token.end() && value < integerShift; ++c ) {
+		value = value * 10 + ( *c - '0' );
+	}
 	checkTooLarge( value );
-	return value + integerShift;
+	return static_cast<unsigned>( value ) + integerShift;
 }
 
-void CAssembler::checkInteger( const std::string token ) const
+void CAssembler::checkInteger( std::string_view token ) const
 {
 	if( !isInteger( token ) ) {
-		throw CSyntaxError( "CAssembler::checkInteger::SyntaxError - The number expected, but '" + token + "' found." );
+		throw CSyntaxError( "CAssembler::checkInteger::SyntaxError - The number expected, but '" + std::string( token )
+			+ "' found" + getPosition() + "." );
 	}
 }
 
-void CAssembler::checkTooLarge( const unsigned value ) const
+void CAssembler::checkTooLarge( const unsigned long long value ) const
 {
 	if( value >= integerShift ) {
-		throw CSyntaxError( "CAssembler::checkInteger::SyntaxError - The number '" + token + "' is too large." );
+		throw CSyntaxError( "CAssembler::checkInteger::SyntaxError - The number '" + std::string( token )
+			+ "' is too large" + getPosition() + "." );
 	}
 }
 
 void CAssembler::doRead()
 {
-	code[current++] = 1;
-	code[current++] = 0;
-	code[current++] = 0;
+	emit( 1 );
+	emit( 0 );
+	emit( 0 );
 }
 
 void CAssembler::doPush()
 {
-	code[current++] = 2;
-	code[current++] = getIntegerOrRegister();
-	code[current++] = 0;
+	emit( 2 );
+	emit( getIntegerOrRegister() );
+	emit( 0 );
 }
 
 void CAssembler::doPop()
 {
-	code[current++] = 3;
-	code[current++] = 0;
-	code[current++] = 0;
+	emit( 3 );
+	emit( 0 );
+	emit( 0 );
 }
 
 void CAssembler::doMove()
 {
-	code[current++] = 4;
-	code[current++] = getIntegerOrRegister();
-	code[current++] = getRegister();
+	emit( 4 );
+	emit( getIntegerOrRegister() );
+	emit( getRegister() );
 }
 
 
 unsigned CAssembler::getRegister()
 {
-	input >> token;
+	token = lexer.Next();
 	return getRegister( token );
 }
 
-unsigned CAssembler::getRegister( const std::string token ) const
+unsigned CAssembler::getRegister( std::string_view token ) const
 {
 	checkRegister( token );
-	return registers.at( token );
+	return findKeyword( token )->Register;
 }
 
 
-void CAssembler::checkRegister( const std::string token ) const
+void CAssembler::checkRegister( std::string_view token ) const
 {
-	if( registers.find( token ) == registers.end() ) {
-		throw CSyntaxError( "CAssembler::checkRegister::SyntaxError - Unknown register '" + token + "'." );
+	const CKeyword* keyword = findKeyword( token );
+	if( keyword == nullptr || keyword->Register == 0 ) {
+		throw CSyntaxError( "CAssembler::checkRegister::SyntaxError - Unknown register '" + std::string( token )
+			+ "'" + getPosition() + "." );
 	}
 }
 
 void CAssembler::doIf()
 {
-	code[current++] = 5;
-	code[current++] = getIntegerOrRegister();
-	code[current++] = getLabel();
+	emit( 5 );
+	emit( getIntegerOrRegister() );
+	emit( getLabel() );
 }
 
 unsigned CAssembler::getLabel()
 {
-	input >> token;
+	token = lexer.Next();
 	checkLabel( token );
-	return labels.at( token );
+	return getSymbolAddress( CImage::LabelSymbol, token );
 }
 
-void CAssembler::checkLabel( const std::string token ) const
+void CAssembler::checkLabel( std::string_view token ) const
 {
-	if( labels.find( token ) == labels.end() ) {
-		throw CSyntaxError( "CAssembler::checkLabel::SyntaxError - Unknown label '" + token + "'." );
+	if( getSymbolAddress( CImage::LabelSymbol, token ) == noAddress ) {
+		throw CSyntaxError( "CAssembler::checkLabel::SyntaxError - Unknown label '" + std::string( token )
+			+ "'" + getPosition() + "." );
 	}
 }
 
 void CAssembler::doCall()
 {
-	code[current++] = 6;
-	code[current++] = getFunction();
-	code[current++] = 0;
+	emit( 6 );
+	emit( getFunction() );
+	emit( 0 );
 }
 
 unsigned CAssembler::getFunction()
 {
-	input >> token;
+	token = lexer.Next();
 	checkFunction( token );
-	return functions.at( token );
+	return getSymbolAddress( CImage::FunctionSymbol, token );
 }
 
-void CAssembler::checkFunction( const std::string token ) const
+void CAssembler::checkFunction( std::string_view token ) const
 {
-	if( functions.find( token ) == functions.end() ) {
-		throw CSyntaxError( "CAssembler::checkFunction::SyntaxError - Unknown function '" + token + "'." );
+	if( getSymbolAddress( CImage::FunctionSymbol, token ) == noAddress ) {
+		throw CSyntaxError( "CAssembler::checkFunction::SyntaxError - Unknown function '" + std::string( token )
+			+ "'" + getPosition() + "." );
 	}
 }
 
 void CAssembler::doEqual()
 {
-	code[current++] = 7;
-	code[current++] = getIntegerOrRegister();
-	code[current++] = getIntegerOrRegister();
+	emit( 7 );
+	emit( getIntegerOrRegister() );
+	emit( getIntegerOrRegister() );
 }
 
 void CAssembler::doAdd()
 {
-	code[current++] = 8;
-	code[current++] = getIntegerOrRegister();
-	code[current++] = getIntegerOrRegister();
+	emit( 8 );
+	emit( getIntegerOrRegister() );
+	emit( getIntegerOrRegister() );
 }
 
 void CAssembler::doSubtract()
 {
-	code[current++] = 9;
-	code[current++] = getIntegerOrRegister();
-	code[current++] = getIntegerOrRegister();
+	emit( 9 );
+	emit( getIntegerOrRegister() );
+	emit( getIntegerOrRegister() );
 }
 
 void CAssembler::doPushaddr()
 {
-	code[current++] = 10;
-	code[current++] = 0;
-	code[current++] = 0;
+	emit( 10 );
+	emit( 0 );
+	emit( 0 );
 }
 
 void CAssembler::doReturn()
 {
-	code[current++] = 11;
-	code[current++] = 0;
-	code[current++] = 0;
+	emit( 11 );
+	emit( 0 );
+	emit( 0 );
 }
 
 void CAssembler::doExit()
 {
-	code[current++] = 12;
-	code[current++] = 0;
-	code[current++] = 0;
+	emit( 12 );
+	emit( 0 );
+	emit( 0 );
 }
 
 void CAssembler::doLabel()
 {
-	input >> token;
+	token = lexer.Next();
 	checkLabel( token );
 	checkFunctionDoubleDefinition( token );
-	code[labels.at( token )] = current;
+	code[getSymbolAddress( CImage::LabelSymbol, token )] = current;
+	labelDefinitions.emplace_back( getSymbolAddress( CImage::LabelSymbol, token ), current );
 }
 
-void CAssembler::checkLabelDoubleDefinition( const std::string token ) const
+void CAssembler::checkLabelDoubleDefinition( std::string_view token ) const
 {
-	if( code[labels.at( token )] != 0 ) {
-		throw CSyntaxError( "CAssembler::checkLabelDoubleDefinition::SyntaxError - Label + '" + token + "' already defined." );
+	if( code[getSymbolAddress( CImage::LabelSymbol, token )] != 0 ) {
+		throw CSyntaxError( "CAssembler::checkLabelDoubleDefinition::SyntaxError - Label + '" + std::string( token )
+			+ "' already defined" + getPosition() + "." );
 	}
 }
 
 void CAssembler::doStr()
 {
-	input >> token;
+	token = lexer.Next();
 	checkString( token );
-	code[current++] = 13;
-	code[current++] = strings.at( token );
-	code[current++] = 0;
+	emit( 13 );
+	emit( getSymbolAddress( CImage::StringSymbol, token ) );
+	emit( 0 );
 }
 
-void CAssembler::checkString( const std::string& token ) const
+void CAssembler::checkString( std::string_view token ) const
 {
-	if( strings.find( token ) == strings.end() ) {
-		throw CSyntaxError( "CAssembler::checkFunction::SyntaxError - Unknown string '" + token + "'." );
+	if( getSymbolAddress( CImage::StringSymbol, token ) == noAddress ) {
+		throw CSyntaxError( "CAssembler::checkFunction::SyntaxError - Unknown string '" + std::string( token )
+			+ "'" + getPosition() + "." );
 	}
 }
 
-void CAssembler::writeBytes( const std::string& pathToBinaryFile ) 
+// Appends zeroed words to the program and returns the address of the first one. The program must leave room
+// for the stack in the memory of the target image.
+unsigned CAssembler::allocate( unsigned wordsCount )
+{
+	if( wordsCount > options.MemorySize - minStackSize - current ) {
+		throw CMemoryOverflow( "CAssembler::allocate::MemoryOverflow - The program does not fit into "
+			+ std::to_string( options.MemorySize ) + " words of memory with a stack of "
+			+ std::to_string( minStackSize ) + " words" + getPosition() + "." );
+	}
+	const unsigned address = current;
+	current += wordsCount;
+	code.resize( current, 0 );
+	return address;
+}
+
+void CAssembler::emit( unsigned word )
+{
+	code[allocate( 1 )] = word;
+}
+
+// Sections follow each other from address 0 to the stack; a section of the same type as the previous one
+// continues it, an empty one is replaced.
+void CAssembler::beginSection( CImage::TSection type )
+{
+	CSection& last = sections.back();
+	last.Length = current - last.Address;
+	if( last.Type == type ) {
+		return;
+	}
+	if( last.Length == 0 ) {
+		last = CSection{ type, current, 0 };
+	} else {
+		sections.push_back( CSection{ type, current, 0 } );
+	}
+}
+
+void CAssembler::writeBytes( const std::string& pathToBinaryFile )
 {
 	std::ofstream output( pathToBinaryFile, std::ios::out | std::ios::binary );
-	char* c = reinterpret_cast<char*>( code );
-	output.write( c, sizeof( unsigned ) * memoryLimit );
+	if( !output.is_open() ) {
+		throw CInvalidFile( "CAssembler::writeBytes::InvalidFile - Cannot open binary file." );
+	}
+	const std::vector<unsigned> words = getBytes();
+	output.write( reinterpret_cast<const char*>( words.data() ), sizeof( unsigned ) * words.size() );
+}
+
+std::vector<unsigned> CAssembler::getBytes()
+{
+	if( options.RawImage ) {
+		std::vector<unsigned> words = code;
+		words.resize( code.size() + options.MemorySize - current, 0 );
+		return words;
+	}
+	return getSections();
+}
+
+// Only the words up to the stack are stored; the stack is described by its range.
+std::vector<unsigned> CAssembler::getSections()
+{
+	beginSection( CImage::StackSection );
+	sections.back().Length = options.MemorySize - current;
+	const std::vector<unsigned> symbols = options.Symbols ? getSymbols() : std::vector<unsigned>();
+	if( !symbols.empty() ) {
+		sections.push_back( CSection{ CImage::SymbolsSection, 0, static_cast<unsigned>( symbols.size() ) } );
+	}
+
+	std::vector<unsigned> words = { CImage::Magic, CImage::Version, options.MemorySize,
+		static_cast<unsigned>( sections.size() ) };
+	unsigned offset = static_cast<unsigned>( words.size() + 4 * sections.size() );
+	for( const CSection& section : sections ) {
+		bool hasData = section.Type != CImage::StackSection;
+		words.insert( words.end(), { static_cast<unsigned>( section.Type ), section.Address, section.Length,
+			hasData ? offset : 0 } );
+		offset += hasData ? section.Length : 0;
+	}
+	for( const CSection& section : sections ) {
+		if( section.Type == CImage::SymbolsSection ) {
+			words.insert( words.end(), symbols.begin(), symbols.end() );
+		} else if( section.Type != CImage::StackSection ) {
+			words.insert( words.end(), code.begin() + section.Address, code.begin() + section.Address + section.Length );
+		}
+	}
+	return words;
+}
+
+// Symbols are ordered by address, so that the same program always gives the same file.
+std::vector<unsigned> CAssembler::getSymbols() const
+{
+	std::vector<CImage::CSymbol> symbols;
+	for( unsigned id = 0; id < symbolNames.size(); ++id ) {
+		for( int kind = 0; kind < CImage::SymbolsCount; ++kind ) {
+			if( symbolAddresses[kind][id] != noAddress ) {
+				symbols.push_back( CImage::CSymbol{ static_cast<CImage::TSymbol>( kind ), symbolAddresses[kind][id],
+					std::string( symbolNames[id] ) } );
+			}
+		}
+	}
+	std::sort( symbols.begin(), symbols.end(),
+		[] ( const CImage::CSymbol& left, const CImage::CSymbol& right )
+	{
+		return left.Address < right.Address;
+	} );
+
+	std::vector<unsigned> words;
+	for( const CImage::CSymbol& symbol : symbols ) {
+		const std::string& name = symbol.Name;
+		words.insert( words.end(), { static_cast<unsigned>( symbol.Kind ), symbol.Address,
+			static_cast<unsigned>( name.length() ) } );
+		words.resize( words.size() + ( name.length() + 3 ) / 4, 0 );
+		unsigned* packed = words.data() + words.size() - ( name.length() + 3 ) / 4;
+		for( size_t i = 0; i < name.length(); ++i ) {
+			packed[i / 4] += static_cast<unsigned char>( name[i] ) << ( 24 - 8 * ( i % 4 ) );
+		}
+	}
+	return words;
+}
+
+unsigned CAssembler::getSymbolAddress( CImage::TSymbol kind, std::string_view name ) const
+{
+	auto id = symbolIds.find( name );
+	return id == symbolIds.end() ? noAddress : symbolAddresses[kind][id->second];
+}
+
+// Names are views into the source, which stays open until the binary file is written.
+void CAssembler::setSymbolAddress( CImage::TSymbol kind, std::string_view name, unsigned address )
+{
+	auto inserted = symbolIds.emplace( name, static_cast<unsigned>( symbolNames.size() ) );
+	if( inserted.second ) {
+		symbolNames.push_back( name );
+		for( std::vector<unsigned>& addresses : symbolAddresses ) {
+			addresses.push_back( noAddress );
+		}
+	}
+	symbolAddresses[kind][inserted.first->second] = address;
+}
+
+std::string CAssembler::getPosition() const
+{
+	return " at " + lexer.GetPosition();
 }
 
 void CAssembler::setIp()
@@ -398,14 +654,14 @@ void CAssembler::setStack()
 
 void CAssembler::clear()
 {
-	input.close();
-	for( int i = 0; i < memoryLimit; ++i ) {
-		code[i] = 0;
-	}
+	lexer.Close();
+	code.clear();
 	current = 0;
-	strings.clear();
-	labels.clear();
-	functions.clear();
-	registers.clear();
-	commands.clear();
+	symbolIds.clear();
+	symbolNames.clear();
+	for( std::vector<unsigned>& addresses : symbolAddresses ) {
+		addresses.clear();
+	}
+	sections.clear();
+	labelDefinitions.clear();
 }
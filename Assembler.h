@@ -1,64 +1,105 @@
 #pragma once
 
+#include "Image.h"
+#include "Lexer.h"
+#include "Optimizer.h"
+
 #include <fstream>
-#include <functional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct CAssemblerOptions {
+	// Writes the whole memory as the binary file, the format of the first versions.
+	bool RawImage = false;
+	// Adds names of strings, labels and functions to a sectioned binary file.
+	bool Symbols = true;
+	// Words of memory of the program; what its code and data leave is the stack.
+	unsigned MemorySize = 65536;
+	// Optimizes the commands of every function, the -O mode.
+	bool Optimize = false;
+};
 
 class CAssembler {
 
 public:
+	// Changes whenever the same source and options may give a different binary file.
+	static const unsigned Version = 1;
+
 	CAssembler();
 
-	void Assembly( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile );
+	void Assembly( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile,
+		const CAssemblerOptions& _options = CAssemblerOptions() );
+	// Assembles a source held in memory and returns the words of the binary file without writing it.
+	std::vector<unsigned> AssemblySource( std::string_view source,
+		const CAssemblerOptions& _options = CAssemblerOptions() );
+	const COptimizer& GetOptimizer() const;
 
 private:
-	static const unsigned memoryLimit = 65536;
+	static const unsigned minStackSize = 64;
 	static const unsigned registersCount = 8;
 	static const unsigned ip = 0;
 	static const unsigned stack = 1;
 	static const unsigned integerShift = 1 << 31;
-	std::ifstream input;
-	std::string token;
-	unsigned code[memoryLimit];
+	static constexpr unsigned noAddress = ~0u;
+	static void ( CAssembler::* const commands[] )();
+
+	struct CSection {
+		CImage::TSection Type;
+		unsigned Address;
+		unsigned Length;
+	};
+
+	CAssemblerOptions options;
+	CLexer lexer;
+	std::string_view token;
+	// Grows with the program, only the stack beyond it is never built.
+	std::vector<unsigned> code;
 	unsigned current = 0;
-	std::unordered_map<std::string, unsigned> strings;
-	std::unordered_map<std::string, unsigned> labels;
-	std::unordered_map<std::string, unsigned> functions;
-	std::unordered_map<std::string, unsigned> registers;
-	std::unordered_map<std::string, std::function<void()>> commands;
+	// Every name gets one id shared by the strings, labels and functions; the addresses are indexed by it.
+	std::unordered_map<std::string_view, unsigned> symbolIds;
+	std::vector<std::string_view> symbolNames;
+	std::vector<unsigned> symbolAddresses[CImage::SymbolsCount];
+	std::vector<CSection> sections;
+	// Slots and addresses of the labels defined among the commands being read.
+	std::vector<std::pair<unsigned, unsigned>> labelDefinitions;
+	COptimizer optimizer;
 
-	void readProgram( const std::string& pathToAssemblerFile );
+	void checkMemorySize() const;
+	void readProgram();
 	void initCode();
 	void readStrings();
-	void readAndCheckKeyword( const std::string keyword );
-	void checkStringDoubleDefinition( const std::string token ) const;
+	void readAndCheckKeyword( std::string_view keyword );
+	void checkStringDoubleDefinition( std::string_view token ) const;
 	void readLabels();
-	void checkLabelDoubleDeclaration( const std::string token ) const;
+	void checkLabelDoubleDeclaration( std::string_view token ) const;
 	void readFunctions();
-	void checkFunctionDoubleDefinition( const std::string token ) const;
-	void readFunction( const std::string name );
-	void setFunction( const std::string name );
+	void checkFunctionDoubleDefinition( std::string_view token ) const;
+	void readFunction( std::string_view name );
+	void setFunction( std::string_view name );
 	void readCommands();
+	void optimizeCommands( unsigned begin );
 	void doPrint();
 	unsigned getIntegerOrRegister();
-	static bool isInteger( const std::string token );
-	unsigned getInteger( const std::string token );
-	void checkInteger( const std::string token ) const;
-	void checkTooLarge( const unsigned value ) const;
+	static bool isInteger( std::string_view token );
+	unsigned getInteger( std::string_view token );
+	void checkInteger( std::string_view token ) const;
+	void checkTooLarge( const unsigned long long value ) const;
 	void doRead();
 	void doPush();
 	void doPop();
 	void doMove();
 	unsigned getRegister();
-	unsigned getRegister( const std::string token ) const;
-	void checkRegister( const std::string token ) const;
+	unsigned getRegister( std::string_view token ) const;
+	void checkRegister( std::string_view token ) const;
 	void doIf();
 	unsigned getLabel();
-	void checkLabel( const std::string token ) const;
+	void checkLabel( std::string_view token ) const;
 	void doCall();
 	unsigned getFunction();
-	void checkFunction( const std::string token ) const;
+	void checkFunction( std::string_view token ) const;
 	void doEqual();
 	void doAdd();
 	void doSubtract();
@@ -66,10 +107,19 @@ private:
 	void doReturn();
 	void doExit();
 	void doLabel();
-	void checkLabelDoubleDefinition( const std::string token ) const;
+	void checkLabelDoubleDefinition( std::string_view token ) const;
 	void doStr();
-	void checkString( const std::string& token ) const;
+	void checkString( std::string_view token ) const;
+	unsigned allocate( unsigned wordsCount );
+	void emit( unsigned word );
+	void beginSection( CImage::TSection type );
 	void writeBytes( const std::string& pathToBinaryFile );
+	std::vector<unsigned> getBytes();
+	std::vector<unsigned> getSections();
+	std::vector<unsigned> getSymbols() const;
+	unsigned getSymbolAddress( CImage::TSymbol kind, std::string_view name ) const;
+	void setSymbolAddress( CImage::TSymbol kind, std::string_view name, unsigned address );
+	std::string getPosition() const;
 	void setIp();
 	void setStack();
 	void clear();
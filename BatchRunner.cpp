@@ -0,0 +1,118 @@
+#include "BatchRunner.h"
+
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+CBatchRunner::CBatchRunner( unsigned _threadsCount, CVirtualMachine::TCore _core ) :
+	threadsCount( _threadsCount ),
+	core( _core )
+{
+	if( threadsCount == 0 ) {
+		threadsCount = std::thread::hardware_concurrency();
+	}
+	if( threadsCount == 0 ) {
+		threadsCount = 1;
+	}
+}
+
+std::vector<CBatchResult> CBatchRunner::Run( const std::vector<CBatchJob>& jobs )
+{
+	std::vector<CBatchResult> results( jobs.size() );
+	const unsigned count = std::max( 1u, std::min( threadsCount, static_cast<unsigned>( jobs.size() ) ) );
+	std::vector<CQueue> queues( count );
+	for( unsigned i = 0; i < jobs.size(); ++i ) {
+		queues[i % count].Jobs.push_back( i );
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for( unsigned i = 1; i < count; ++i ) {
+		threads.emplace_back( &CBatchRunner::work, this, i, std::ref( queues ), std::cref( jobs ), std::ref( results ) );
+	}
+	work( 0, queues, jobs, results );
+	for( std::thread& thread : threads ) {
+		thread.join();
+	}
+	auto finish = std::chrono::steady_clock::now();
+
+	wallTime = std::chrono::duration<double>( finish - start ).count();
+	executedCount = 0;
+	for( const CBatchResult& result : results ) {
+		executedCount += result.ExecutedCount;
+	}
+	return results;
+}
+
+unsigned CBatchRunner::GetThreadsCount() const
+{
+	return threadsCount;
+}
+
+double CBatchRunner::GetWallTime() const
+{
+	return wallTime;
+}
+
+unsigned long long CBatchRunner::GetExecutedCount() const
+{
+	return executedCount;
+}
+
+// Each result is written by exactly one thread, so results need no locking.
+void CBatchRunner::work( unsigned index, std::vector<CQueue>& queues, const std::vector<CBatchJob>& jobs,
+	std::vector<CBatchResult>& results ) const
+{
+	CVirtualMachine virtualMachine( core );
+	std::istringstream input;
+	std::ostringstream output;
+	unsigned job = 0;
+	while( takeJob( queues, index, job ) ) {
+		runJob( virtualMachine, input, output, jobs[job], results[job] );
+	}
+}
+
+// Takes the next job of the own queue or, if it is empty, the last job of the first nonempty other queue.
+// Jobs are never added while the batch runs, so all queues being empty means the work is over.
+bool CBatchRunner::takeJob( std::vector<CQueue>& queues, unsigned index, unsigned& job )
+{
+	{
+		std::lock_guard<std::mutex> lock( queues[index].Mutex );
+		if( !queues[index].Jobs.empty() ) {
+			job = queues[index].Jobs.front();
+			queues[index].Jobs.pop_front();
+			return true;
+		}
+	}
+	for( unsigned i = 1; i < queues.size(); ++i ) {
+		CQueue& victim = queues[( index + i ) % queues.size()];
+		std::lock_guard<std::mutex> lock( victim.Mutex );
+		if( !victim.Jobs.empty() ) {
+			job = victim.Jobs.back();
+			victim.Jobs.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+// The streams live as long as the machine, which keeps pointers to them between jobs.
+void CBatchRunner::runJob( CVirtualMachine& virtualMachine, std::istringstream& input, std::ostringstream& output,
+	const CBatchJob& job, CBatchResult& result )
+{
+	input.clear();
+	input.str( job.Input );
+	output.str( "" );
+	virtualMachine.SetInput( input );
+	virtualMachine.SetOutput( output, COutput::TFlushPolicy::Exit );
+	auto start = std::chrono::steady_clock::now();
+	try {
+		virtualMachine.Execute( job.PathToBinaryFile );
+	} catch( const std::exception& exception ) {
+		result.Error = exception.what();
+	}
+	auto finish = std::chrono::steady_clock::now();
+	result.Seconds = std::chrono::duration<double>( finish - start ).count();
+	result.ExecutedCount = virtualMachine.GetExecutedCount();
+	result.Output = output.str();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "VirtualMachine.h"
+
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct CBatchJob {
+	std::string PathToBinaryFile;
+	std::string Input;
+};
+
+struct CBatchResult {
+	std::string Output;
+	// Message of the exception that stopped the program, empty if it ran to the end.
+	std::string Error;
+	unsigned long long ExecutedCount = 0;
+	double Seconds = 0;
+};
+
+// Runs independent programs on a pool of threads. Every thread owns a virtual machine that executes its jobs
+// one after another with input taken from the job and output captured into the result. Jobs are dealt to
+// per-thread queues in advance; a thread that runs out of them steals from the back of the other queues, so
+// a long job does not hold up the short ones queued behind it.
+class CBatchRunner {
+
+public:
+	explicit CBatchRunner( unsigned _threadsCount = 0, CVirtualMachine::TCore _core = CVirtualMachine::TCore::Decoded );
+
+	std::vector<CBatchResult> Run( const std::vector<CBatchJob>& jobs );
+	unsigned GetThreadsCount() const;
+	double GetWallTime() const;
+	unsigned long long GetExecutedCount() const;
+
+private:
+	struct CQueue {
+		std::mutex Mutex;
+		std::deque<unsigned> Jobs;
+	};
+
+	unsigned threadsCount;
+	CVirtualMachine::TCore core;
+	double wallTime = 0;
+	unsigned long long executedCount = 0;
+
+	void work( unsigned index, std::vector<CQueue>& queues, const std::vector<CBatchJob>& jobs,
+		std::vector<CBatchResult>& results ) const;
+	static bool takeJob( std::vector<CQueue>& queues, unsigned index, unsigned& job );
+	static void runJob( CVirtualMachine& virtualMachine, std::istringstream& input, std::ostringstream& output,
+		const CBatchJob& job, CBatchResult& result );
+};
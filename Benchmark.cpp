@@ -0,0 +1,212 @@
+#include "Assembler.h"
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+CBenchmark::CBenchmark( std::ostream& _report ) :
+	report( _report )
+{
+}
+
+void CBenchmark::Run( const std::string& pathToAssemblerFile, const std::string& input, unsigned repetitions )
+{
+	const std::string pathToBinaryFile = pathToAssemblerFile + ".benchmark.bin";
+	CAssembler assembler;
+	assembler.Assembly( pathToAssemblerFile, pathToBinaryFile );
+
+	std::string expectedOutput;
+	runCores( pathToBinaryFile, input, repetitions, "", expectedOutput );
+	measureOptimized( pathToAssemblerFile, pathToBinaryFile, input, repetitions, expectedOutput );
+	measureStartup( pathToAssemblerFile, pathToBinaryFile, repetitions );
+	std::remove( pathToBinaryFile.c_str() );
+}
+
+// Runs the same batch of jobs with 1, 2, 4... threads up to the number of hardware threads and compares
+// the results with a separate run of every input. There are at least twice as many jobs as threads, so every
+// worker runs several jobs on its machine.
+bool CBenchmark::RunBatch( const std::string& pathToAssemblerFile, const std::vector<std::string>& inputs,
+	unsigned jobsCount )
+{
+	const std::string pathToBinaryFile = pathToAssemblerFile + ".benchmark.bin";
+	CAssembler assembler;
+	assembler.Assembly( pathToAssemblerFile, pathToBinaryFile );
+
+	const unsigned maxThreadsCount = CBatchRunner().GetThreadsCount();
+	jobsCount = std::max( jobsCount, 2 * maxThreadsCount );
+	std::vector<CBatchJob> jobs;
+	for( unsigned i = 0; i < jobsCount; ++i ) {
+		jobs.push_back( CBatchJob{ pathToBinaryFile, inputs[i % inputs.size()] } );
+	}
+	std::vector<CBatchResult> expectedResults( inputs.size() );
+	for( size_t i = 0; i < inputs.size(); ++i ) {
+		measure( CVirtualMachine::TCore::Decoded, pathToBinaryFile, inputs[i], expectedResults[i].ExecutedCount,
+			expectedResults[i].Output );
+	}
+	bool isAllMatching = true;
+	double singleThreadTime = 0;
+	for( unsigned threadsCount = 1; ; threadsCount = std::min( threadsCount * 2, maxThreadsCount ) ) {
+		CBatchRunner runner( threadsCount );
+		std::vector<CBatchResult> results = runner.Run( jobs );
+		if( threadsCount == 1 ) {
+			singleThreadTime = runner.GetWallTime();
+		}
+		bool isMatching = true;
+		for( size_t i = 0; i < results.size(); ++i ) {
+			const CBatchResult& expected = expectedResults[i % inputs.size()];
+			isMatching = isMatching && results[i].Output == expected.Output && results[i].Error.empty()
+				&& results[i].ExecutedCount == expected.ExecutedCount;
+		}
+		isAllMatching = isAllMatching && isMatching;
+		reportBatch( runner, results, singleThreadTime, isMatching );
+		if( threadsCount == maxThreadsCount ) {
+			break;
+		}
+	}
+	std::remove( pathToBinaryFile.c_str() );
+	return isAllMatching;
+}
+
+// The output of the first run becomes the expected one if none is given yet.
+void CBenchmark::runCores( const std::string& pathToBinaryFile, const std::string& input, unsigned repetitions,
+	const std::string& suffix, std::string& expectedOutput )
+{
+	for( CVirtualMachine::TCore core : { CVirtualMachine::TCore::Table, CVirtualMachine::TCore::Threaded,
+		CVirtualMachine::TCore::Decoded, CVirtualMachine::TCore::Jit } ) {
+		unsigned long long executedCount = 0;
+		std::string output;
+		double best = 0;
+		for( unsigned i = 0; i < repetitions; ++i ) {
+			double seconds = measure( core, pathToBinaryFile, input, executedCount, output );
+			best = i == 0 ? seconds : std::min( best, seconds );
+		}
+		if( expectedOutput.empty() ) {
+			expectedOutput = output;
+		}
+		report << GetCoreName( core ) << suffix << ": " << executedCount << " instructions, " << best << " s, "
+			<< static_cast<unsigned long long>( executedCount / best ) << " instructions/s, output "
+			<< ( output == expectedOutput ? "matches" : "DIFFERS FROM" ) << " table" << std::endl;
+		if( core == CVirtualMachine::TCore::Decoded ) {
+			report << "  fused pairs: " << fusionsReport << std::endl;
+		}
+	}
+}
+
+// Runs the program assembled in the -O mode on every core and compares it with the plain image.
+void CBenchmark::measureOptimized( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile,
+	const std::string& input, unsigned repetitions, std::string& expectedOutput )
+{
+	const std::string pathToOptimizedFile = pathToAssemblerFile + ".benchmark.O.bin";
+	CAssemblerOptions options;
+	options.Optimize = true;
+	CAssembler assembler;
+	assembler.Assembly( pathToAssemblerFile, pathToOptimizedFile, options );
+	report << "-O: " << getFileSize( pathToBinaryFile ) << " -> " << getFileSize( pathToOptimizedFile ) << " bytes, "
+		<< assembler.GetOptimizer().GetRemovedCount() << " commands removed, "
+		<< assembler.GetOptimizer().GetFoldedCount() << " folded" << std::endl;
+	runCores( pathToOptimizedFile, input, repetitions, " -O", expectedOutput );
+	std::remove( pathToOptimizedFile.c_str() );
+}
+
+// Input comes from the given string, output is collected to compare the cores with each other.
+double CBenchmark::measure( CVirtualMachine::TCore core, const std::string& pathToBinaryFile, const std::string& input,
+	unsigned long long& executedCount, std::string& output )
+{
+	std::istringstream inputStream( input );
+	std::ostringstream outputStream;
+	CVirtualMachine virtualMachine( core );
+	virtualMachine.SetInput( inputStream );
+	virtualMachine.SetOutput( outputStream, COutput::TFlushPolicy::Exit );
+	auto start = std::chrono::steady_clock::now();
+	virtualMachine.Execute( pathToBinaryFile );
+	auto finish = std::chrono::steady_clock::now();
+
+	executedCount = virtualMachine.GetExecutedCount();
+	output = outputStream.str();
+	fusionsReport = virtualMachine.GetFusionsReport();
+	return std::chrono::duration<double>( finish - start ).count();
+}
+
+// Compares loading of the raw memory image, mapped and read at once, with loading of the sectioned file.
+void CBenchmark::measureStartup( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile,
+	unsigned repetitions )
+{
+	const std::string pathToRawFile = pathToAssemblerFile + ".benchmark.raw.bin";
+	CAssemblerOptions options;
+	options.RawImage = true;
+	CAssembler assembler;
+	assembler.Assembly( pathToAssemblerFile, pathToRawFile, options );
+
+	double bestMapped = 0;
+	double bestRead = 0;
+	double bestSectioned = 0;
+	for( unsigned i = 0; i < repetitions; ++i ) {
+		double mapped = measureLoad( pathToRawFile, true );
+		double read = measureLoad( pathToRawFile, false );
+		double sectioned = measureLoad( pathToBinaryFile, true );
+		bestMapped = i == 0 ? mapped : std::min( bestMapped, mapped );
+		bestRead = i == 0 ? read : std::min( bestRead, read );
+		bestSectioned = i == 0 ? sectioned : std::min( bestSectioned, sectioned );
+	}
+	report << "startup: raw " << getFileSize( pathToRawFile ) << " bytes mapped " << bestMapped * 1e6 << " us, read "
+		<< bestRead * 1e6 << " us; sectioned " << getFileSize( pathToBinaryFile ) << " bytes "
+		<< bestSectioned * 1e6 << " us per load" << std::endl;
+	std::remove( pathToRawFile.c_str() );
+}
+
+// Returns the average time of loading the image and touching its first and last words.
+double CBenchmark::measureLoad( const std::string& pathToBinaryFile, bool allowMapping )
+{
+	unsigned checksum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for( unsigned i = 0; i < loadsCount; ++i ) {
+		CImage image;
+		image.Load( pathToBinaryFile, allowMapping );
+		checksum += image[0] + image[image.Size() - 1];
+	}
+	auto finish = std::chrono::steady_clock::now();
+	volatile unsigned sink = checksum;
+	static_cast<void>( sink );
+	return std::chrono::duration<double>( finish - start ).count() / loadsCount;
+}
+
+void CBenchmark::reportBatch( const CBatchRunner& runner, std::vector<CBatchResult> results, double singleThreadTime,
+	bool isMatching )
+{
+	std::sort( results.begin(), results.end(),
+		[] ( const CBatchResult& left, const CBatchResult& right )
+	{
+		return left.Seconds < right.Seconds;
+	} );
+	const double wallTime = runner.GetWallTime();
+	report << "batch, " << runner.GetThreadsCount() << " threads: " << results.size() << " jobs, " << wallTime << " s, "
+		<< static_cast<unsigned long long>( results.size() / wallTime ) << " jobs/s, "
+		<< static_cast<unsigned long long>( runner.GetExecutedCount() / wallTime ) << " instructions/s, speedup "
+		<< singleThreadTime / wallTime << ", job " << results.front().Seconds * 1e3 << "/"
+		<< results[results.size() / 2].Seconds * 1e3 << "/" << results.back().Seconds * 1e3
+		<< " ms min/median/max, results " << ( isMatching ? "match" : "DIFFER FROM" ) << " separate runs" << std::endl;
+}
+
+unsigned long long CBenchmark::getFileSize( const std::string& path )
+{
+	std::ifstream file( path, std::ios::in | std::ios::binary | std::ios::ate );
+	return static_cast<unsigned long long>( file.tellg() );
+}
+
+std::string CBenchmark::GetCoreName( CVirtualMachine::TCore core )
+{
+	switch( core ) {
+		case CVirtualMachine::TCore::Table:
+			return "table";
+		case CVirtualMachine::TCore::Threaded:
+			return "threaded";
+		case CVirtualMachine::TCore::Decoded:
+			return "decoded";
+		case CVirtualMachine::TCore::Jit:
+			return "jit";
+	}
+	return "unknown";
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "BatchRunner.h"
+#include "VirtualMachine.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+class CBenchmark {
+
+public:
+	explicit CBenchmark( std::ostream& _report );
+
+	void Run( const std::string& pathToAssemblerFile, const std::string& input, unsigned repetitions );
+	// Returns false if some job's results differ from a separate run of its input.
+	bool RunBatch( const std::string& pathToAssemblerFile, const std::vector<std::string>& inputs, unsigned jobsCount );
+	static std::string GetCoreName( CVirtualMachine::TCore core );
+
+private:
+	static const unsigned loadsCount = 1000;
+	std::ostream& report;
+	std::string fusionsReport;
+
+	void runCores( const std::string& pathToBinaryFile, const std::string& input, unsigned repetitions,
+		const std::string& suffix, std::string& expectedOutput );
+	void measureOptimized( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile,
+		const std::string& input, unsigned repetitions, std::string& expectedOutput );
+	double measure( CVirtualMachine::TCore core, const std::string& pathToBinaryFile, const std::string& input,
+		unsigned long long& executedCount, std::string& output );
+	void measureStartup( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile,
+		unsigned repetitions );
+	static double measureLoad( const std::string& pathToBinaryFile, bool allowMapping );
+	void reportBatch( const CBatchRunner& runner, std::vector<CBatchResult> results, double singleThreadTime,
+		bool isMatching );
+	static unsigned long long getFileSize( const std::string& path );
+};
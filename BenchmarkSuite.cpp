@@ -0,0 +1,215 @@
+#include "Assembler.h"
+#include "Benchmark.h"
+#include "BenchmarkSuite.h"
+#include "Disassembler.h"
+#include "Exception.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+CBenchmarkSuite::CBenchmarkSuite( std::ostream& _report, unsigned _repetitions, unsigned _warmUpsCount ) :
+	report( _report ),
+	repetitions( std::max( _repetitions, 1u ) ),
+	warmUpsCount( _warmUpsCount )
+{
+}
+
+void CBenchmarkSuite::AddProgram( const std::string& name, const std::string& pathToAssemblerFile,
+	const std::string& input )
+{
+	programs.push_back( CProgram{ name, pathToAssemblerFile, input, false, 0, 0, {}, {}, {}, {} } );
+}
+
+// Writes a program of many small functions, each with its own string and label, called one after another from
+// the main commands. It stresses the assembler and the disassembler with a large source rather than the VM.
+void CBenchmarkSuite::AddGeneratedProgram( const std::string& name, const std::string& pathToAssemblerFile,
+	unsigned functionsCount )
+{
+	std::ofstream output( pathToAssemblerFile, std::ios::out );
+	if( !output.is_open() ) {
+		throw CInvalidFile( "CBenchmarkSuite::AddGeneratedProgram::InvalidFile - Cannot open assembler file." );
+	}
+	output << "strings\n  banner Generated program of " << functionsCount << " functions.\n.\nlabels\n.\nfunctions\n";
+	for( unsigned i = 0; i < functionsCount; ++i ) {
+		const std::string index = std::to_string( i );
+		output << "  f" << index << "\n"
+			<< "    strings\n      s" << index << " Function " << index << " reached.\n    .\n"
+			<< "    labels\n      l" << index << "\n    .\n"
+			<< "    functions\n    .\n"
+			<< "    commands\n"
+			<< "      pop\n      move res reg1\n      pop\n      move res reg2\n      push reg1\n"
+			<< "      add reg2 1\n      move res reg2\n      equal reg2 0\n      if res l" << index << "\n"
+			<< "      label l" << index << "\n      pop\n      push reg2\n      return\n"
+			<< "    .\n";
+	}
+	output << ".\ncommands\n  str banner\n  move 0 reg3\n";
+	for( unsigned i = 0; i < functionsCount; ++i ) {
+		output << "  push " << i << "\n  pushaddr\n  call f" << i << "\n  pop\n  add res reg3\n  move res reg3\n";
+	}
+	output << "  print reg3\n  exit\n.\n";
+	programs.push_back( CProgram{ name, pathToAssemblerFile, "", true, 0, 0, {}, {}, {}, {} } );
+}
+
+void CBenchmarkSuite::Run()
+{
+	for( CProgram& program : programs ) {
+		runProgram( program );
+		reportProgram( program );
+		if( program.IsGenerated ) {
+			std::remove( program.PathToAssemblerFile.c_str() );
+		}
+	}
+}
+
+void CBenchmarkSuite::WriteJson( std::ostream& stream ) const
+{
+	stream << "{\n  \"version\": 1,\n  \"repetitions\": " << repetitions << ",\n  \"warm_ups\": " << warmUpsCount
+		<< ",\n  \"programs\": [";
+	for( unsigned i = 0; i < programs.size(); ++i ) {
+		const CProgram& program = programs[i];
+		stream << ( i == 0 ? "" : "," ) << "\n    {\n      \"name\": \"" << escape( program.Name ) << "\",\n"
+			<< "      \"generated\": " << ( program.IsGenerated ? "true" : "false" ) << ",\n"
+			<< "      \"lines\": " << program.LinesCount << ",\n      \"words\": " << program.WordsCount << ",\n";
+		writeTiming( stream, "assembler", program.Assembler, program.LinesCount, "lines" );
+		writeTiming( stream, "load", program.Load, program.WordsCount, "words" );
+		writeTiming( stream, "disassembler", program.Disassembler, program.WordsCount, "words" );
+		stream << "      \"cores\": [";
+		for( unsigned j = 0; j < program.Cores.size(); ++j ) {
+			const CCoreResult& core = program.Cores[j];
+			stream << ( j == 0 ? "" : "," ) << "\n        { \"core\": \"" << CBenchmark::GetCoreName( core.Core )
+				<< "\", \"instructions\": " << core.ExecutedCount << ", \"median_seconds\": " << core.Timing.Median
+				<< ", \"min_seconds\": " << core.Timing.Min << ", \"max_seconds\": " << core.Timing.Max
+				<< ", \"instructions_per_second\": "
+				<< static_cast<unsigned long long>( core.ExecutedCount / core.Timing.Median )
+				<< ", \"output_matches\": " << ( core.IsMatching ? "true" : "false" ) << " }";
+		}
+		stream << "\n      ]\n    }";
+	}
+	stream << "\n  ]\n}\n";
+	stream.flush();
+}
+
+void CBenchmarkSuite::runProgram( CProgram& program )
+{
+	const std::string pathToBinaryFile = program.PathToAssemblerFile + ".suite.bin";
+	const std::string pathToDisassemblerFile = program.PathToAssemblerFile + ".suite.disasm";
+	CAssembler assembler;
+	CDisassembler disassembler;
+	program.LinesCount = countLines( program.PathToAssemblerFile );
+	program.Assembler = measure( [&] () { assembler.Assembly( program.PathToAssemblerFile, pathToBinaryFile ); } );
+	program.WordsCount = countWords( pathToBinaryFile );
+	program.Load = measure( [&] () { CImage image; image.Load( pathToBinaryFile ); } );
+	program.Disassembler = measure( [&] () { disassembler.Disassembly( pathToBinaryFile, pathToDisassemblerFile ); } );
+
+	std::string expectedOutput;
+	program.Cores.clear();
+	for( CVirtualMachine::TCore core : { CVirtualMachine::TCore::Table, CVirtualMachine::TCore::Threaded,
+		CVirtualMachine::TCore::Decoded, CVirtualMachine::TCore::Jit } ) {
+		std::string output;
+		program.Cores.push_back( runCore( core, pathToBinaryFile, program.Input, output ) );
+		if( core == CVirtualMachine::TCore::Table ) {
+			expectedOutput = output;
+		}
+		program.Cores.back().IsMatching = output == expectedOutput;
+	}
+	std::remove( pathToBinaryFile.c_str() );
+	std::remove( pathToDisassemblerFile.c_str() );
+}
+
+// The output of the last run is kept to check that all cores agree. The machine keeps pointers to the
+// streams between repetitions, so they live as long as it does.
+CBenchmarkSuite::CCoreResult CBenchmarkSuite::runCore( CVirtualMachine::TCore core, const std::string& pathToBinaryFile,
+	const std::string& input, std::string& output ) const
+{
+	CVirtualMachine virtualMachine( core );
+	std::istringstream inputStream;
+	std::ostringstream outputStream;
+	CTiming timing = measure( [&] ()
+	{
+		inputStream.clear();
+		inputStream.str( input );
+		outputStream.str( "" );
+		virtualMachine.SetInput( inputStream );
+		virtualMachine.SetOutput( outputStream, COutput::TFlushPolicy::Exit );
+		virtualMachine.Execute( pathToBinaryFile );
+		output = outputStream.str();
+	} );
+	return CCoreResult{ core, virtualMachine.GetExecutedCount(), timing, true };
+}
+
+template<class TAction>
+CBenchmarkSuite::CTiming CBenchmarkSuite::measure( TAction action ) const
+{
+	for( unsigned i = 0; i < warmUpsCount; ++i ) {
+		action();
+	}
+	std::vector<double> seconds;
+	for( unsigned i = 0; i < repetitions; ++i ) {
+		auto start = std::chrono::steady_clock::now();
+		action();
+		auto finish = std::chrono::steady_clock::now();
+		seconds.push_back( std::chrono::duration<double>( finish - start ).count() );
+	}
+	std::sort( seconds.begin(), seconds.end() );
+	return CTiming{ seconds[seconds.size() / 2], seconds.front(), seconds.back() };
+}
+
+void CBenchmarkSuite::reportProgram( const CProgram& program ) const
+{
+	report << program.Name << ": " << program.LinesCount << " lines, " << program.WordsCount << " words" << std::endl;
+	report << "  assembler: " << program.Assembler.Median * 1e3 << " ms, "
+		<< static_cast<unsigned long long>( program.LinesCount / program.Assembler.Median ) << " lines/s" << std::endl;
+	report << "  load: " << program.Load.Median * 1e6 << " us" << std::endl;
+	report << "  disassembler: " << program.Disassembler.Median * 1e3 << " ms, "
+		<< static_cast<unsigned long long>( program.WordsCount / program.Disassembler.Median ) << " words/s" << std::endl;
+	for( const CCoreResult& core : program.Cores ) {
+		report << "  " << CBenchmark::GetCoreName( core.Core ) << ": " << core.ExecutedCount << " instructions, "
+			<< core.Timing.Median << " s (" << core.Timing.Min << "-" << core.Timing.Max << "), "
+			<< static_cast<unsigned long long>( core.ExecutedCount / core.Timing.Median ) << " instructions/s, output "
+			<< ( core.IsMatching ? "matches" : "DIFFERS FROM" ) << " table" << std::endl;
+	}
+}
+
+void CBenchmarkSuite::writeTiming( std::ostream& stream, const std::string& name, const CTiming& timing, double amount,
+	const std::string& unit )
+{
+	stream << "      \"" << name << "\": { \"median_seconds\": " << timing.Median << ", \"min_seconds\": " << timing.Min
+		<< ", \"max_seconds\": " << timing.Max << ", \"" << unit << "_per_second\": "
+		<< static_cast<unsigned long long>( amount / timing.Median ) << " },\n";
+}
+
+unsigned CBenchmarkSuite::countLines( const std::string& pathToAssemblerFile )
+{
+	std::ifstream input( pathToAssemblerFile, std::ios::in );
+	if( !input.is_open() ) {
+		throw CInvalidFile( "CBenchmarkSuite::countLines::InvalidFile - Cannot open assembler file." );
+	}
+	unsigned count = 0;
+	for( std::string line; std::getline( input, line ); ) {
+		++count;
+	}
+	return count;
+}
+
+// Words of the program up to the initial stack pointer, the part the disassembler walks through.
+unsigned CBenchmarkSuite::countWords( const std::string& pathToBinaryFile )
+{
+	CImage image;
+	image.Load( pathToBinaryFile );
+	return image[1];
+}
+
+std::string CBenchmarkSuite::escape( const std::string& string )
+{
+	std::string escaped;
+	for( char c : string ) {
+		if( c == '"' || c == '\\' ) {
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "VirtualMachine.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Set of workloads measured end to end: assembling, loading, disassembling and running on every core. Each
+// measurement is taken after warm-up runs and summarized by the median of the repetitions; the results can
+// be written as JSON to compare versions with each other.
+class CBenchmarkSuite {
+
+public:
+	CBenchmarkSuite( std::ostream& _report, unsigned _repetitions = 5, unsigned _warmUpsCount = 1 );
+
+	void AddProgram( const std::string& name, const std::string& pathToAssemblerFile, const std::string& input );
+	void AddGeneratedProgram( const std::string& name, const std::string& pathToAssemblerFile, unsigned functionsCount );
+	void Run();
+	void WriteJson( std::ostream& stream ) const;
+
+private:
+	struct CTiming {
+		double Median;
+		double Min;
+		double Max;
+	};
+
+	struct CCoreResult {
+		CVirtualMachine::TCore Core;
+		unsigned long long ExecutedCount;
+		CTiming Timing;
+		bool IsMatching;
+	};
+
+	struct CProgram {
+		std::string Name;
+		std::string PathToAssemblerFile;
+		std::string Input;
+		bool IsGenerated;
+		unsigned LinesCount;
+		unsigned WordsCount;
+		CTiming Assembler;
+		CTiming Load;
+		CTiming Disassembler;
+		std::vector<CCoreResult> Cores;
+	};
+
+	std::ostream& report;
+	unsigned repetitions;
+	unsigned warmUpsCount;
+	std::vector<CProgram> programs;
+
+	void runProgram( CProgram& program );
+	CCoreResult runCore( CVirtualMachine::TCore core, const std::string& pathToBinaryFile, const std::string& input,
+		std::string& output ) const;
+	template<class TAction>
+	CTiming measure( TAction action ) const;
+	void reportProgram( const CProgram& program ) const;
+	static void writeTiming( std::ostream& stream, const std::string& name, const CTiming& timing, double amount,
+		const std::string& unit );
+	static unsigned countLines( const std::string& pathToAssemblerFile );
+	static unsigned countWords( const std::string& pathToBinaryFile );
+	static std::string escape( const std::string& string );
+};
@@ -0,0 +1,176 @@
+#include "CallProfiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+
+CCallProfiler::CCallProfiler()
+{
+}
+
+void CCallProfiler::Start( const CImage& code )
+{
+	nodes.assign( 1, CNode{ programFunction, 0, {}, 1, 0, 0, 0 } );
+	frames.assign( 1, CFrame{ 0, TClock::now() } );
+	names.clear();
+	for( const CImage::CSymbol& symbol : code.GetSymbols() ) {
+		if( symbol.Kind == CImage::FunctionSymbol ) {
+			names[symbol.Address] = symbol.Name;
+		}
+	}
+}
+
+// Called before the command at address runs: call and return belong to the function they are executed in.
+// A return without a matching call leaves the program frame in place.
+void CCallProfiler::Count( unsigned address, unsigned command, const CImage& code )
+{
+	++nodes[frames.back().Node].SelfCount;
+	if( command == callCommand ) {
+		enter( code[address + 1] );
+	} else if( command == returnCommand && frames.size() > 1 ) {
+		leave();
+	}
+}
+
+void CCallProfiler::Return()
+{
+	if( frames.size() > 1 ) {
+		leave();
+	}
+}
+
+// Closes the frames left open by exit inside a function or by an error.
+void CCallProfiler::Finish()
+{
+	while( !frames.empty() ) {
+		leave();
+	}
+	sumTotals();
+}
+
+// Recursion is counted once: a function's inclusive values only come from its outermost activations.
+void CCallProfiler::WriteReport( std::ostream& stream ) const
+{
+	struct CTotals {
+		unsigned long long CallsCount = 0;
+		unsigned long long SelfCount = 0;
+		unsigned long long TotalCount = 0;
+		double SelfSeconds = 0;
+		double Seconds = 0;
+	};
+	std::map<unsigned, CTotals> functions;
+	for( unsigned i = 0; i < nodes.size(); ++i ) {
+		CTotals& totals = functions[nodes[i].Function];
+		totals.CallsCount += nodes[i].CallsCount;
+		totals.SelfCount += nodes[i].SelfCount;
+		totals.SelfSeconds += getSelfSeconds( i );
+		if( i == 0 || !hasAncestor( nodes[i].Parent, nodes[i].Function ) ) {
+			totals.TotalCount += nodes[i].TotalCount;
+			totals.Seconds += nodes[i].Seconds;
+		}
+	}
+	std::vector<std::pair<unsigned, CTotals>> sorted( functions.begin(), functions.end() );
+	std::stable_sort( sorted.begin(), sorted.end(),
+		[] ( const std::pair<unsigned, CTotals>& left, const std::pair<unsigned, CTotals>& right )
+	{
+		return left.second.TotalCount > right.second.TotalCount;
+	} );
+
+	stream << std::left << std::setw( 24 ) << "function" << std::right << std::setw( 12 ) << "calls"
+		<< std::setw( 16 ) << "inclusive" << std::setw( 16 ) << "exclusive" << std::setw( 14 ) << "incl. ms"
+		<< std::setw( 14 ) << "excl. ms" << std::endl;
+	stream << std::fixed << std::setprecision( 3 );
+	for( const auto& function : sorted ) {
+		const CTotals& totals = function.second;
+		stream << std::left << std::setw( 24 ) << getName( function.first ) << std::right << std::setw( 12 )
+			<< totals.CallsCount << std::setw( 16 ) << totals.TotalCount << std::setw( 16 ) << totals.SelfCount
+			<< std::setw( 14 ) << totals.Seconds * 1e3 << std::setw( 14 ) << totals.SelfSeconds * 1e3 << std::endl;
+	}
+	stream << std::defaultfloat;
+}
+
+void CCallProfiler::WriteFolded( std::ostream& stream, TMetric metric ) const
+{
+	for( unsigned i = 0; i < nodes.size(); ++i ) {
+		unsigned long long value = metric == TMetric::Instructions ? nodes[i].SelfCount
+			: static_cast<unsigned long long>( getSelfSeconds( i ) * 1e6 + 0.5 );
+		if( value != 0 ) {
+			stream << getPath( i ) << " " << value << "\n";
+		}
+	}
+	stream.flush();
+}
+
+void CCallProfiler::enter( unsigned function )
+{
+	CNode& parent = nodes[frames.back().Node];
+	auto child = parent.Children.find( function );
+	unsigned node = 0;
+	if( child != parent.Children.end() ) {
+		node = child->second;
+	} else {
+		node = static_cast<unsigned>( nodes.size() );
+		parent.Children[function] = node;
+		nodes.push_back( CNode{ function, frames.back().Node, {}, 0, 0, 0, 0 } );
+	}
+	++nodes[node].CallsCount;
+	frames.push_back( CFrame{ node, TClock::now() } );
+}
+
+void CCallProfiler::leave()
+{
+	const CFrame& frame = frames.back();
+	nodes[frame.Node].Seconds += std::chrono::duration<double>( TClock::now() - frame.Start ).count();
+	frames.pop_back();
+}
+
+// Children are always created after their parents, so one backward pass adds every subtree to its parent.
+void CCallProfiler::sumTotals()
+{
+	for( CNode& node : nodes ) {
+		node.TotalCount = node.SelfCount;
+	}
+	for( unsigned i = static_cast<unsigned>( nodes.size() ) - 1; i > 0; --i ) {
+		nodes[nodes[i].Parent].TotalCount += nodes[i].TotalCount;
+	}
+}
+
+std::string CCallProfiler::getName( unsigned function ) const
+{
+	if( function == programFunction ) {
+		return "program";
+	}
+	auto name = names.find( function );
+	return name != names.end() ? name->second : "function" + std::to_string( function );
+}
+
+std::string CCallProfiler::getPath( unsigned node ) const
+{
+	std::string path = getName( nodes[node].Function );
+	for( unsigned i = node; i != 0; ) {
+		i = nodes[i].Parent;
+		path = getName( nodes[i].Function ) + ";" + path;
+	}
+	return path;
+}
+
+double CCallProfiler::getSelfSeconds( unsigned node ) const
+{
+	double seconds = nodes[node].Seconds;
+	for( const auto& child : nodes[node].Children ) {
+		seconds -= nodes[child.second].Seconds;
+	}
+	return std::max( seconds, 0.0 );
+}
+
+bool CCallProfiler::hasAncestor( unsigned node, unsigned function ) const
+{
+	for( unsigned i = node; ; i = nodes[i].Parent ) {
+		if( nodes[i].Function == function ) {
+			return true;
+		}
+		if( i == 0 ) {
+			return false;
+		}
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Image.h"
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Dynamic call tree of a profiled run. Functions are entered by call, which jumps through the function slot,
+// and left by return; every executed instruction is attributed to the function on top of the call stack.
+// A function is identified by its slot and named from the symbol table of the image when it has one.
+class CCallProfiler {
+
+public:
+	enum class TMetric {
+		Instructions,
+		Microseconds
+	};
+
+	CCallProfiler();
+
+	void Start( const CImage& code );
+	void Count( unsigned address, unsigned command, const CImage& code );
+	// Leaves the function entered by the last call without executing its return, as a memoized call does.
+	void Return();
+	void Finish();
+	void WriteReport( std::ostream& stream ) const;
+	// One line per call path: frames from the outermost one separated by ';', then the exclusive value;
+	// the format read by flamegraph.pl and similar tools.
+	void WriteFolded( std::ostream& stream, TMetric metric = TMetric::Instructions ) const;
+
+private:
+	typedef std::chrono::steady_clock TClock;
+
+	static const unsigned callCommand = 6;
+	static const unsigned returnCommand = 11;
+	static const unsigned programFunction = ~0u;
+
+	struct CNode {
+		unsigned Function;
+		unsigned Parent;
+		std::unordered_map<unsigned, unsigned> Children;
+		unsigned long long CallsCount;
+		unsigned long long SelfCount;
+		unsigned long long TotalCount;
+		double Seconds;
+	};
+
+	struct CFrame {
+		unsigned Node;
+		TClock::time_point Start;
+	};
+
+	std::vector<CNode> nodes;
+	std::vector<CFrame> frames;
+	std::unordered_map<unsigned, std::string> names;
+
+	void enter( unsigned function );
+	void leave();
+	void sumTotals();
+	std::string getName( unsigned function ) const;
+	std::string getPath( unsigned node ) const;
+	double getSelfSeconds( unsigned node ) const;
+	bool hasAncestor( unsigned node, unsigned function ) const;
+};
@@ -0,0 +1,250 @@
+#include "CompileCache.h"
+#include "Exception.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <thread>
+
+namespace {
+
+const unsigned long long sourceSeed = 0xCBF29CE484222325ull;
+const unsigned long long checkSeed = 0x84222325CBF29CE4ull;
+const unsigned long long nameSeed = 0x9E3779B97F4A7C15ull;
+const char* const entryExtension = ".vmc";
+const char* const temporaryExtension = ".tmp";
+
+} // namespace
+
+CCompileCache::CCompileCache( const std::string& _directory, unsigned long long _maxSize ) :
+	directory( _directory ),
+	maxSize( _maxSize )
+{
+	std::error_code error;
+	std::filesystem::create_directories( directory, error );
+	if( !std::filesystem::is_directory( directory, error ) ) {
+		throw CInvalidArguments( "CCompileCache::CCompileCache::InvalidArguments - Cannot create cache directory." );
+	}
+}
+
+// A cache that cannot be written to still assembles; only the failed entry is lost.
+std::vector<unsigned> CCompileCache::Assembly( std::string_view source, const CAssemblerOptions& options )
+{
+	const std::vector<unsigned> key = getKey( source, options );
+	const std::string path = ( std::filesystem::path( directory )
+		/ ( toHex( hash( key.data(), key.size() * sizeof( unsigned ), nameSeed ) ) + entryExtension ) ).string();
+	std::vector<unsigned> words;
+	if( load( path, key, words ) ) {
+		++hitsCount;
+		return words;
+	}
+	++missesCount;
+	words = assembler.AssemblySource( source, options );
+	store( path, key, words );
+	return words;
+}
+
+void CCompileCache::Assembly( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile,
+	const CAssemblerOptions& options )
+{
+	std::ifstream input( pathToAssemblerFile, std::ios::in | std::ios::binary );
+	if( !input.is_open() ) {
+		throw CInvalidFile( "CCompileCache::Assembly::InvalidFile - Cannot open assembler file." );
+	}
+	const std::string source( ( std::istreambuf_iterator<char>( input ) ), std::istreambuf_iterator<char>() );
+	const std::vector<unsigned> words = Assembly( source, options );
+	std::ofstream output( pathToBinaryFile, std::ios::out | std::ios::binary );
+	if( !output.is_open() ) {
+		throw CInvalidFile( "CCompileCache::Assembly::InvalidFile - Cannot open binary file." );
+	}
+	output.write( reinterpret_cast<const char*>( words.data() ), sizeof( unsigned ) * words.size() );
+}
+
+unsigned long long CCompileCache::GetHitsCount() const
+{
+	return hitsCount;
+}
+
+unsigned long long CCompileCache::GetMissesCount() const
+{
+	return missesCount;
+}
+
+// The key is compared in full, and it holds two hashes of the source made with different seeds, so only a
+// double collision of 64-bit hashes could return the binary file of another source.
+bool CCompileCache::load( const std::string& path, const std::vector<unsigned>& key,
+	std::vector<unsigned>& words ) const
+{
+	std::ifstream input( path, std::ios::in | std::ios::binary | std::ios::ate );
+	if( !input.is_open() ) {
+		return false;
+	}
+	const unsigned long long bytesCount = static_cast<unsigned long long>( input.tellg() );
+	unsigned header[headerSize];
+	input.seekg( 0 );
+	if( bytesCount < sizeof( header ) || !input.read( reinterpret_cast<char*>( header ), sizeof( header ) )
+		|| header[0] != Magic || header[1] != Version || !std::equal( key.begin(), key.end(), header + 2 )
+		|| bytesCount != ( headerSize + 2ull + header[headerSize - 1] ) * sizeof( unsigned ) )
+	{
+		return false;
+	}
+	words.resize( header[headerSize - 1] );
+	unsigned stored[2];
+	if( !input.read( reinterpret_cast<char*>( words.data() ), words.size() * sizeof( unsigned ) )
+		|| !input.read( reinterpret_cast<char*>( stored ), sizeof( stored ) ) )
+	{
+		return false;
+	}
+	const unsigned long long checksum = hash( words.data(), words.size() * sizeof( unsigned ), checkSeed );
+	if( stored[0] != static_cast<unsigned>( checksum ) || stored[1] != static_cast<unsigned>( checksum >> 32 ) ) {
+		return false;
+	}
+	input.close();
+	std::error_code error;
+	std::filesystem::last_write_time( path, std::filesystem::file_time_type::clock::now(), error );
+	return true;
+}
+
+void CCompileCache::store( const std::string& path, const std::vector<unsigned>& key,
+	const std::vector<unsigned>& words )
+{
+	std::vector<unsigned> entry = { Magic, Version };
+	entry.insert( entry.end(), key.begin(), key.end() );
+	entry.push_back( static_cast<unsigned>( words.size() ) );
+	entry.insert( entry.end(), words.begin(), words.end() );
+	const unsigned long long checksum = hash( words.data(), words.size() * sizeof( unsigned ), checkSeed );
+	entry.push_back( static_cast<unsigned>( checksum ) );
+	entry.push_back( static_cast<unsigned>( checksum >> 32 ) );
+
+	const std::string temporaryPath = getTemporaryPath( path );
+	{
+		std::ofstream output( temporaryPath, std::ios::out | std::ios::binary );
+		if( !output.write( reinterpret_cast<const char*>( entry.data() ), sizeof( unsigned ) * entry.size() )
+			|| !output.flush() )
+		{
+			output.close();
+			std::error_code error;
+			std::filesystem::remove( temporaryPath, error );
+			return;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename( temporaryPath, path, error );
+	if( error ) {
+		std::filesystem::remove( temporaryPath, error );
+		return;
+	}
+	evict();
+}
+
+// Entries of other processes may disappear while they are listed; whatever cannot be examined or removed
+// is left for the next eviction.
+void CCompileCache::evict() const
+{
+	struct CEntry {
+		std::filesystem::path Path;
+		std::filesystem::file_time_type Time;
+		unsigned long long Size;
+	};
+
+	std::error_code error;
+	const std::filesystem::file_time_type staleTime = std::filesystem::file_time_type::clock::now()
+		- std::chrono::seconds( staleSeconds );
+	std::vector<CEntry> entries;
+	unsigned long long totalSize = 0;
+	for( std::filesystem::directory_iterator i( directory, error ), end; !error && i != end; i.increment( error ) ) {
+		const std::filesystem::path& entryPath = i->path();
+		const std::filesystem::file_time_type time = std::filesystem::last_write_time( entryPath, error );
+		if( error ) {
+			error.clear();
+			continue;
+		}
+		if( entryPath.extension() == temporaryExtension && time < staleTime ) {
+			std::filesystem::remove( entryPath, error );
+			error.clear();
+		} else if( entryPath.extension() == entryExtension ) {
+			const unsigned long long size = std::filesystem::file_size( entryPath, error );
+			if( !error ) {
+				entries.push_back( CEntry{ entryPath, time, size } );
+				totalSize += size;
+			}
+			error.clear();
+		}
+	}
+	if( totalSize <= maxSize ) {
+		return;
+	}
+	std::sort( entries.begin(), entries.end(),
+		[] ( const CEntry& left, const CEntry& right )
+	{
+		return left.Time < right.Time;
+	} );
+	for( const CEntry& entry : entries ) {
+		if( totalSize <= maxSize ) {
+			break;
+		}
+		if( std::filesystem::remove( entry.Path, error ) ) {
+			totalSize -= entry.Size;
+		}
+		error.clear();
+	}
+}
+
+// Unique among the threads and processes writing to the directory: the thread id and the time tell writers
+// apart, and the count tells apart the stores of one writer.
+std::string CCompileCache::getTemporaryPath( const std::string& path )
+{
+	const unsigned long long thread = std::hash<std::thread::id>()( std::this_thread::get_id() );
+	const unsigned long long time = static_cast<unsigned long long>(
+		std::chrono::high_resolution_clock::now().time_since_epoch().count() );
+	return path + "." + toHex( thread ^ time ) + "." + std::to_string( storesCount++ ) + temporaryExtension;
+}
+
+std::vector<unsigned> CCompileCache::getKey( std::string_view source, const CAssemblerOptions& options )
+{
+	const unsigned long long size = source.size();
+	const unsigned long long sourceHash = hash( source.data(), source.size(), sourceSeed );
+	const unsigned long long checkHash = hash( source.data(), source.size(), checkSeed );
+	return { CAssembler::Version, CImage::Version, options.RawImage, options.Symbols, options.MemorySize,
+		options.Optimize, static_cast<unsigned>( size ), static_cast<unsigned>( size >> 32 ),
+		static_cast<unsigned>( sourceHash ), static_cast<unsigned>( sourceHash >> 32 ),
+		static_cast<unsigned>( checkHash ), static_cast<unsigned>( checkHash >> 32 ) };
+}
+
+// Eight bytes per multiplication, so that hashing a large source costs far less than assembling it; the final
+// mix spreads every input bit over the whole value.
+unsigned long long CCompileCache::hash( const void* data, size_t size, unsigned long long seed )
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>( data );
+	unsigned long long value = seed ^ size;
+	size_t i = 0;
+	for( ; i + sizeof( unsigned long long ) <= size; i += sizeof( unsigned long long ) ) {
+		unsigned long long word;
+		std::memcpy( &word, bytes + i, sizeof( word ) );
+		value = ( value ^ word ) * 0x9E3779B97F4A7C15ull;
+		value ^= value >> 32;
+	}
+	for( ; i < size; ++i ) {
+		value = ( value ^ bytes[i] ) * 0x100000001B3ull;
+	}
+	value ^= value >> 33;
+	value *= 0xFF51AFD7ED558CCDull;
+	value ^= value >> 33;
+	value *= 0xC4CEB9FE1A85EC53ull;
+	value ^= value >> 33;
+	return value;
+}
+
+std::string CCompileCache::toHex( unsigned long long value )
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string hex( 16, '0' );
+	for( int i = 15; i >= 0; --i, value >>= 4 ) {
+		hex[i] = digits[value & 0xF];
+	}
+	return hex;
+}
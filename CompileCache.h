@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Assembler.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Persistent cache of assembled binary files, addressed by the content of the source together with the
+// versions of the assembler and of the binary format and the options. A hit reads the stored words and skips
+// the assembler entirely.
+//
+// Every entry is a file of its own named by the hash of its key; it starts with Magic, Version, the key and
+// the number of words, and ends with the words of the binary file and their checksum, so an entry of another
+// source or a damaged one is taken for a miss. Entries are written to a temporary file and renamed into
+// place, which is atomic, so processes sharing the directory see either a whole entry or none. A hit touches
+// the entry; once the entries exceed the size limit, the least recently used ones are removed.
+class CCompileCache {
+
+public:
+	static const unsigned Magic = 0x43434D56;
+	static const unsigned Version = 1;
+
+	explicit CCompileCache( const std::string& _directory, unsigned long long _maxSize = 256ull << 20 );
+
+	std::vector<unsigned> Assembly( std::string_view source, const CAssemblerOptions& options = CAssemblerOptions() );
+	void Assembly( const std::string& pathToAssemblerFile, const std::string& pathToBinaryFile,
+		const CAssemblerOptions& options = CAssemblerOptions() );
+	unsigned long long GetHitsCount() const;
+	unsigned long long GetMissesCount() const;
+
+private:
+	static const unsigned keySize = 12;
+	static const unsigned headerSize = keySize + 3;
+	// Temporary files older than this are left by writers that did not finish.
+	static constexpr unsigned staleSeconds = 600;
+
+	std::string directory;
+	unsigned long long maxSize;
+	unsigned long long hitsCount = 0;
+	unsigned long long missesCount = 0;
+	unsigned long long storesCount = 0;
+	CAssembler assembler;
+
+	bool load( const std::string& path, const std::vector<unsigned>& key, std::vector<unsigned>& words ) const;
+	void store( const std::string& path, const std::vector<unsigned>& key, const std::vector<unsigned>& words );
+	void evict() const;
+	std::string getTemporaryPath( const std::string& path );
+	static std::vector<unsigned> getKey( std::string_view source, const CAssemblerOptions& options );
+	static unsigned long long hash( const void* data, size_t size, unsigned long long seed );
+	static std::string toHex( unsigned long long value );
+};
@@ -0,0 +1,263 @@
+#include "DecodedProgram.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+static_assert( CDecodedProgram::Raw == 0, "Zeroed entries must be raw." );
+
+CDecodedProgram::CDecodedProgram()
+{
+}
+
+CDecodedProgram::~CDecodedProgram()
+{
+	Clear();
+}
+
+// Only addresses from programStart up to limit - 3 are specialized, so that every decoded entry is built from
+// words lying below limit (the initial stack pointer). Registers and the stack are written all the time and
+// commands placed there always go through the raw path.
+void CDecodedProgram::Decode( const CImage& code, unsigned _limit )
+{
+	limit = _limit < code.Size() ? _limit : code.Size();
+	invalidatedCount = 0;
+	std::free( commands );
+	commands = static_cast<CDecodedCommand*>( std::calloc( code.Size(), sizeof( CDecodedCommand ) ) );
+	if( commands == nullptr ) {
+		throw std::bad_alloc();
+	}
+	for( unsigned i = programStart; i + 2 < limit; ++i ) {
+		commands[i] = decodeCommand( code[i], code[i + 1], code[i + 2] );
+	}
+	fuse();
+	resolve( code );
+}
+
+// A fused entry covers six words, so the three entries before the usual ones are dropped too if they are fused.
+void CDecodedProgram::Invalidate( unsigned address )
+{
+	if( address >= limit ) {
+		return;
+	}
+	for( unsigned i = address < 5 ? 0 : address - 5; i <= address; ++i ) {
+		if( commands[i].Operation != Raw && ( i + 2 >= address || commands[i].Operation >= PushaddrCall ) ) {
+			commands[i].Operation = Raw;
+			++invalidatedCount;
+		}
+	}
+}
+
+// Entries that no longer branch, because they were invalidated, are left alone.
+const std::vector<unsigned>& CDecodedProgram::Retarget( unsigned slot, unsigned target )
+{
+	static const std::vector<unsigned> none;
+	auto found = branches.find( slot );
+	if( found == branches.end() ) {
+		return none;
+	}
+	for( unsigned address : found->second ) {
+		unsigned* branchTarget = getTarget( commands[address] );
+		if( branchTarget != nullptr ) {
+			*branchTarget = target;
+		}
+	}
+	return found->second;
+}
+
+// Returns the entry of the first command of a fused pair; other entries are returned as they are.
+CDecodedCommand CDecodedProgram::Split( const CDecodedCommand& command )
+{
+	switch( command.Operation ) {
+		case PushaddrCall:
+			return CDecodedCommand{ Pushaddr, 0, 0, 0 };
+		case EqualIfImmediateImmediate:
+		case EqualIfImmediateRegister:
+		case EqualIfRegisterImmediate:
+		case EqualIfRegisterRegister:
+			return CDecodedCommand{ command.Operation - EqualIfImmediateImmediate + EqualImmediateImmediate,
+				command.Argument1, command.Argument2, 0 };
+		case PopMove:
+			return CDecodedCommand{ Pop, 0, 0, 0 };
+	}
+	return command;
+}
+
+const CDecodedCommand* CDecodedProgram::Data() const
+{
+	return commands;
+}
+
+unsigned CDecodedProgram::GetLimit() const
+{
+	return limit;
+}
+
+unsigned CDecodedProgram::GetInvalidatedCount() const
+{
+	return invalidatedCount;
+}
+
+unsigned CDecodedProgram::GetFusedCount( TFusion fusion ) const
+{
+	return fusedCounts[fusion];
+}
+
+void CDecodedProgram::Clear()
+{
+	std::free( commands );
+	commands = nullptr;
+	branches.clear();
+	limit = 0;
+	invalidatedCount = 0;
+	std::fill( fusedCounts, fusedCounts + FusionsCount, 0 );
+}
+
+// Entries are visited in order of addresses, so the second command of a pair is still unfused when
+// its first command is looked at. Arguments of the second command go to Argument3 or replace unused ones.
+void CDecodedProgram::fuse()
+{
+	std::fill( fusedCounts, fusedCounts + FusionsCount, 0 );
+	for( unsigned i = programStart; i + 5 < limit; ++i ) {
+		CDecodedCommand& first = commands[i];
+		const CDecodedCommand& second = commands[i + 3];
+		if( first.Operation == Pushaddr && second.Operation == Call ) {
+			first = CDecodedCommand{ PushaddrCall, second.Argument1, second.Argument1, 0 };
+			++fusedCounts[PushaddrCallFusion];
+		} else if( isEqual( first.Operation ) && second.Operation == IfRegister && second.Argument1 == resIndex ) {
+			first.Operation = first.Operation - EqualImmediateImmediate + EqualIfImmediateImmediate;
+			first.Argument3 = second.Argument2;
+			++fusedCounts[EqualIfFusion];
+		} else if( first.Operation == Pop && second.Operation == MoveRegister && second.Argument1 == resIndex ) {
+			first = CDecodedCommand{ PopMove, 0, second.Argument2, 0 };
+			++fusedCounts[PopMoveFusion];
+		}
+	}
+}
+
+// Branches come out of decoding and fusion with their slot in place of the target; slots outside the image
+// leave the command to the raw path, which reports the error.
+void CDecodedProgram::resolve( const CImage& code )
+{
+	branches.clear();
+	for( unsigned i = programStart; i < limit; ++i ) {
+		CDecodedCommand& command = commands[i];
+		unsigned* target = getTarget( command );
+		if( target == nullptr ) {
+			continue;
+		}
+		const unsigned slot = *target;
+		if( slot >= code.Size() ) {
+			command = CDecodedCommand{ Raw, 0, 0, 0 };
+			continue;
+		}
+		*target = code[slot];
+		branches[slot].push_back( i );
+	}
+}
+
+unsigned* CDecodedProgram::getTarget( CDecodedCommand& command )
+{
+	switch( command.Operation ) {
+		case IfImmediate:
+		case IfRegister:
+		case EqualIfImmediateImmediate:
+		case EqualIfImmediateRegister:
+		case EqualIfRegisterImmediate:
+		case EqualIfRegisterRegister:
+			return &command.Argument3;
+		case Call:
+		case PushaddrCall:
+			return &command.Argument2;
+	}
+	return nullptr;
+}
+
+bool CDecodedProgram::isEqual( unsigned operation )
+{
+	return operation >= EqualImmediateImmediate && operation <= EqualRegisterRegister;
+}
+
+CDecodedCommand CDecodedProgram::decodeCommand( unsigned command, unsigned argument1, unsigned argument2 )
+{
+	switch( command ) {
+		case 0:
+			return decodeUnary( argument1, PrintImmediate, PrintRegister );
+		case 1:
+			return CDecodedCommand{ Read, 0, 0, 0 };
+		case 2:
+			return decodeUnary( argument1, PushImmediate, PushRegister );
+		case 3:
+			return CDecodedCommand{ Pop, 0, 0, 0 };
+		case 4: {
+			if( !isRegister( argument2 ) ) {
+				return CDecodedCommand{ Raw, 0, 0, 0 };
+			}
+			CDecodedCommand decoded = decodeUnary( argument1, MoveImmediate, MoveRegister );
+			decoded.Argument2 = argument2;
+			return decoded;
+		}
+		case 5: {
+			if( argument2 < programStart ) {
+				return CDecodedCommand{ Raw, 0, 0, 0 };
+			}
+			CDecodedCommand decoded = decodeUnary( argument1, IfImmediate, IfRegister );
+			decoded.Argument2 = argument2;
+			decoded.Argument3 = argument2;
+			return decoded;
+		}
+		case 6:
+			return CDecodedCommand{ argument1 < programStart ? Raw : Call, argument1, argument1, 0 };
+		case 7:
+			return decodeBinary( argument1, argument2, EqualImmediateImmediate );
+		case 8:
+			return decodeBinary( argument1, argument2, AddImmediateImmediate );
+		case 9:
+			return decodeBinary( argument1, argument2, SubtractImmediateImmediate );
+		case 10:
+			return CDecodedCommand{ Pushaddr, 0, 0, 0 };
+		case 11:
+			return CDecodedCommand{ Return, 0, 0, 0 };
+		case 12:
+			return CDecodedCommand{ Exit, 0, 0, 0 };
+		case 13:
+			return CDecodedCommand{ argument1 < programStart ? Raw : Str, argument1, 0, 0 };
+	}
+	return CDecodedCommand{ Raw, 0, 0, 0 };
+}
+
+CDecodedCommand CDecodedProgram::decodeUnary( unsigned argument, TOperation immediate, TOperation reg )
+{
+	if( isInteger( argument ) ) {
+		return CDecodedCommand{ immediate, getOperand( argument ), 0, 0 };
+	} else if( isRegister( argument ) ) {
+		return CDecodedCommand{ reg, getOperand( argument ), 0, 0 };
+	}
+	return CDecodedCommand{ Raw, 0, 0, 0 };
+}
+
+// The four specializations of every binary command follow each other in TOperation in the order
+// immediate-immediate, immediate-register, register-immediate, register-register.
+CDecodedCommand CDecodedProgram::decodeBinary( unsigned argument1, unsigned argument2, TOperation immediateImmediate )
+{
+	if( ( !isInteger( argument1 ) && !isRegister( argument1 ) ) || ( !isInteger( argument2 ) && !isRegister( argument2 ) ) ) {
+		return CDecodedCommand{ Raw, 0, 0, 0 };
+	}
+	unsigned operation = immediateImmediate + ( isRegister( argument1 ) ? 2 : 0 ) + ( isRegister( argument2 ) ? 1 : 0 );
+	return CDecodedCommand{ operation, getOperand( argument1 ), getOperand( argument2 ), 0 };
+}
+
+bool CDecodedProgram::isInteger( unsigned word )
+{
+	return word >= integerShift;
+}
+
+bool CDecodedProgram::isRegister( unsigned word )
+{
+	return word >= firstRegister && word <= resIndex;
+}
+
+unsigned CDecodedProgram::getOperand( unsigned word )
+{
+	return isInteger( word ) ? word - integerShift : word;
+}
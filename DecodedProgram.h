@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Image.h"
+
+#include <unordered_map>
+#include <vector>
+
+struct CDecodedCommand {
+	unsigned Operation;
+	unsigned Argument1;
+	unsigned Argument2;
+	unsigned Argument3;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// Decoded form of every address of the program image. An entry at address a describes the command made of
+// words a, a + 1 and a + 2 with operand kinds already resolved: immediates are stored without integerShift,
+// registers as their addresses. Anything that cannot be specialized, and any command whose words are written
+// at runtime, is left to the raw path. Frequent pairs of commands get a single fused entry at the address
+// of the first one; the entry of the second command stays as it is for jumps landing on it.
+//
+// Branches are resolved at decode time: if, call and their fused forms carry the address stored in their
+// label or function slot, so they jump without reading the slot. Every branch is remembered by its slot, and a
+// write to a slot at runtime retargets the branches going through it.
+class CDecodedProgram {
+
+public:
+	enum TOperation {
+		Raw,
+		PrintImmediate,
+		PrintRegister,
+		Read,
+		PushImmediate,
+		PushRegister,
+		Pop,
+		MoveImmediate,
+		MoveRegister,
+		// Value or register, slot, target.
+		IfImmediate,
+		IfRegister,
+		// Slot, target.
+		Call,
+		EqualImmediateImmediate,
+		EqualImmediateRegister,
+		EqualRegisterImmediate,
+		EqualRegisterRegister,
+		AddImmediateImmediate,
+		AddImmediateRegister,
+		AddRegisterImmediate,
+		AddRegisterRegister,
+		SubtractImmediateImmediate,
+		SubtractImmediateRegister,
+		SubtractRegisterImmediate,
+		SubtractRegisterRegister,
+		Pushaddr,
+		Return,
+		Exit,
+		Str,
+		// Fused pairs: pushaddr + call (slot, target), equal + if res (operands, target), pop + move res reg.
+		PushaddrCall,
+		EqualIfImmediateImmediate,
+		EqualIfImmediateRegister,
+		EqualIfRegisterImmediate,
+		EqualIfRegisterRegister,
+		PopMove,
+		OperationsCount
+	};
+
+	enum TFusion {
+		PushaddrCallFusion,
+		EqualIfFusion,
+		PopMoveFusion,
+		FusionsCount
+	};
+
+	CDecodedProgram();
+	CDecodedProgram( const CDecodedProgram& ) = delete;
+	CDecodedProgram& operator=( const CDecodedProgram& ) = delete;
+	~CDecodedProgram();
+
+	void Decode( const CImage& code, unsigned _limit );
+	void Invalidate( unsigned address );
+	// Points the branches through the slot at the new target and returns their addresses.
+	const std::vector<unsigned>& Retarget( unsigned slot, unsigned target );
+	static CDecodedCommand Split( const CDecodedCommand& command );
+	const CDecodedCommand* Data() const;
+	unsigned GetLimit() const;
+	unsigned GetInvalidatedCount() const;
+	// Pairs fused by the last Decode.
+	unsigned GetFusedCount( TFusion fusion ) const;
+	void Clear();
+
+private:
+	static const unsigned integerShift = 1 << 31;
+	static const unsigned firstRegister = 2;
+	static const unsigned resIndex = 9;
+	static const unsigned programStart = resIndex + 1;
+	// Zeroed memory is all Raw entries; a large allocation gets its pages lazily, so only the program part
+	// of the table costs memory, which matters when many machines are loaded at once.
+	CDecodedCommand* commands = nullptr;
+	unsigned limit = 0;
+	unsigned invalidatedCount = 0;
+	unsigned fusedCounts[FusionsCount] = {};
+	// Addresses of the decoded branches going through each slot.
+	std::unordered_map<unsigned, std::vector<unsigned>> branches;
+
+	void fuse();
+	void resolve( const CImage& code );
+	static unsigned* getTarget( CDecodedCommand& command );
+	static bool isEqual( unsigned operation );
+	static CDecodedCommand decodeCommand( unsigned command, unsigned argument1, unsigned argument2 );
+	static CDecodedCommand decodeUnary( unsigned argument, TOperation immediate, TOperation reg );
+	static CDecodedCommand decodeBinary( unsigned argument1, unsigned argument2, TOperation immediateImmediate );
+	static bool isInteger( unsigned word );
+	static bool isRegister( unsigned word );
+	static unsigned getOperand( unsigned word );
+};
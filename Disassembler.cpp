@@ -1,7 +1,6 @@
 #include "Disassembler.h"
 #include "Exception.h"
 
-#include <experimental/filesystem>
 #include <fstream>
 
 CDisassembler::CDisassembler()
@@ -10,27 +9,29 @@ CDisassembler::CDisassembler()
 
 void CDisassembler::Disassembly( const std::string& pathToBinaryFile, const std::string& pathToAssemblerFile )
 {
-	init( pathToBinaryFile );
+	code.Load( pathToBinaryFile );
+	init();
 	readBytes();
 	writeProgram( pathToAssemblerFile );
 	clear();
 }
 
-void CDisassembler::init( const std::string& pathToBinaryFile )
+std::string CDisassembler::DisassemblyImage( const unsigned* words, size_t wordsCount )
 {
-	std::ifstream input( pathToBinaryFile, std::ios::in | std::ios::binary );
-	if( !input.is_open() ) {
-		throw CInvalidFile( "CDisassembler::readBytes::initCode - Cannot open binary file." );
-	}
-
-	unsigned bytesCount = std::experimental::filesystem::file_size( pathToBinaryFile );
-	unsigned length = bytesCount / 4;
-	code.assign( length, 0 );
+	code.Load( words, wordsCount );
+	init();
+	readBytes();
+	std::string source;
+	source.swap( program );
+	clear();
+	return source;
+}
 
-	for( unsigned i = 0; i < length; ++i ) {
-		input.read( reinterpret_cast< char* >( &( code[i] ) ), sizeof( unsigned ) );
+void CDisassembler::init()
+{
+	for( const CImage::CSymbol& symbol : code.GetSymbols() ) {
+		names[symbol.Kind][symbol.Address] = symbol.Name;
 	}
-	input.close();
 
 	current = 10;
 
@@ -52,6 +53,16 @@ void CDisassembler::init( const std::string& pathToBinaryFile )
 	};
 }
 
+// Names come from the symbol table of the binary file if it has one, otherwise they are made of addresses.
+std::string CDisassembler::getName( CImage::TSymbol kind, const std::string& prefix, unsigned address ) const
+{
+	auto name = names[kind].find( address );
+	if( name != names[kind].end() ) {
+		return name->second;
+	}
+	return prefix + std::to_string( address );
+}
+
 void CDisassembler::decodePrint()
 {
 	std::string argument1 = getRegisterOrNumber( code[current + 1] );
@@ -110,13 +121,13 @@ void CDisassembler::decodeMove()
 void CDisassembler::decodeIf()
 {
 	std::string argument1 = getRegisterOrNumber( code[current + 1] );
-	std::string argument2 = "label" + std::to_string( code[current + 2] );
+	std::string argument2 = getName( CImage::LabelSymbol, "label", code[current + 2] );
 	append( "if " + argument1 + " " + argument2 + "\n" );
 }
 
 void CDisassembler::decodeCall()
 {
-	std::string argument1 = "function" + std::to_string( code[current + 1] );
+	std::string argument1 = getName( CImage::FunctionSymbol, "function", code[current + 1] );
 	append( "call " + argument1 + "\n" );
 }
 
@@ -158,7 +169,7 @@ void CDisassembler::decodeExit()
 
 void CDisassembler::decodeStr()
 {
-	std::string argument1 = "string" + std::to_string( code[current + 1] );
+	std::string argument1 = getName( CImage::StringSymbol, "string", code[current + 1] );
 	append( "str " + argument1 + "\n" );
 }
 
@@ -188,7 +199,7 @@ void CDisassembler::readStrings()
 			++i;
 		}
 		if( string != "" ) {
-			append( "string" + std::to_string( current ) + " " + string + "\n" );
+			append( getName( CImage::StringSymbol, "string", current ) + " " + string + "\n" );
 		}
 		current = i + 1;
 	}
@@ -203,7 +214,7 @@ void CDisassembler::readLabels()
 	++tabsCount;
 	while( code[current] != 0 ) {
 		labels[code[current]] = current;
-		append( "label" + std::to_string( current ) + "\n" );
+		append( getName( CImage::LabelSymbol, "label", current ) + "\n" );
 		++current;
 	}
 	--tabsCount;
@@ -226,7 +237,7 @@ void CDisassembler::readFunctions()
 
 void CDisassembler::readFunction()
 {
-	append( "function" + std::to_string( current ) + "\n" );
+	append( getName( CImage::FunctionSymbol, "function", current ) + "\n" );
 	++current;
 	++tabsCount;
 	readStrings();
@@ -253,7 +264,7 @@ void CDisassembler::readCommands()
 void CDisassembler::tryAddLabel()
 {
 	if( labels.find( current ) != labels.end() ) {
-		append( "label label" + std::to_string( labels[current] ) + "\n" );
+		append( "label " + getName( CImage::LabelSymbol, "label", labels[current] ) + "\n" );
 	}
 }
 
@@ -266,10 +277,13 @@ void CDisassembler::writeProgram( const std::string & pathToAssemblerFile ) cons
 
 void CDisassembler::clear()
 {
-	code.clear();
+	code.Clear();
 	current = 0;
 	labels.clear();
 	functions.clear();
+	for( auto& kindNames : names ) {
+		kindNames.clear();
+	}
 	commands.clear();
 	program = "";
 	tabsCount = 0;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Image.h"
+
 #include <functional>
 #include <string>
 #include <vector>
@@ -11,19 +13,23 @@ public:
 	CDisassembler();
 
 	void Disassembly( const std::string& pathToBinaryFile, const std::string& pathToAssemblerFile );
+	// Disassembles a binary file held in memory and returns the source.
+	std::string DisassemblyImage( const unsigned* words, size_t wordsCount );
 
 private:
 	static const unsigned integerShift = 1 << 31;
 	static const unsigned resIndex = 9;
-	std::vector<unsigned> code;
+	CImage code;
 	unsigned current = 0;
 	std::unordered_map<unsigned, unsigned> labels;
 	std::vector<unsigned> functions;
+	std::unordered_map<unsigned, std::string> names[CImage::SymbolsCount];
 	std::vector<std::function<void()>> commands;
 	std::string program = "";
 	unsigned tabsCount = 0;
 
-	void init( const std::string& pathToBinaryFile );
+	void init();
+	std::string getName( CImage::TSymbol kind, const std::string& prefix, unsigned address ) const;
 	void decodePrint();
 	static std::string getRegisterOrNumber( unsigned value );
 	static std::string getRegister( unsigned value );
@@ -0,0 +1,325 @@
+#include "EventLoop.h"
+#include "Exception.h"
+
+#ifdef VM_HAS_EPOLL
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+CEventLoop::CEventLoop( unsigned long long _quantum, CVirtualMachine::TCore _core ) :
+	quantum( _quantum ),
+	core( _core ),
+	chunk( chunkSize )
+{
+	if( quantum == 0 ) {
+		throw CInvalidArguments( "CEventLoop::CEventLoop::InvalidArguments - Quantum must be positive." );
+	}
+#ifdef VM_HAS_EPOLL
+	poller = epoll_create1( EPOLL_CLOEXEC );
+	if( poller < 0 ) {
+		throw CInvalidArguments( "CEventLoop::CEventLoop::InvalidArguments - Cannot create epoll instance." );
+	}
+#endif
+}
+
+CEventLoop::~CEventLoop()
+{
+	for( unsigned i = 0; i < sessions.size(); ++i ) {
+		if( !sessions[i]->IsFinished ) {
+			finish( i );
+		}
+	}
+#ifdef VM_HAS_EPOLL
+	close( poller );
+#endif
+}
+
+bool CEventLoop::IsSupported()
+{
+#ifdef VM_HAS_EPOLL
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Descriptors epoll refuses to watch, such as regular files and /dev/null, never have to wait: such input is
+// read whole right away, and such output is written in place.
+unsigned CEventLoop::Add( const std::string& pathToBinaryFile, int inputDescriptor, int outputDescriptor )
+{
+#ifdef VM_HAS_EPOLL
+	std::unique_ptr<CSession> session( new CSession );
+	session->VirtualMachine.reset( new CVirtualMachine( core ) );
+	session->VirtualMachine->SetOutput( session->Output, COutput::TFlushPolicy::Exit );
+	session->VirtualMachine->Load( pathToBinaryFile );
+	session->VirtualMachine->AppendInput( "" );
+	session->InputDescriptor = inputDescriptor;
+	session->OutputDescriptor = outputDescriptor;
+	session->InputFlags = fcntl( inputDescriptor, F_GETFL );
+	session->OutputFlags = fcntl( outputDescriptor, F_GETFL );
+	if( session->InputFlags < 0 || session->OutputFlags < 0 ) {
+		throw CInvalidArguments( "CEventLoop::Add::InvalidArguments - Invalid descriptor." );
+	}
+	const unsigned index = static_cast<unsigned>( sessions.size() );
+	sessions.push_back( std::move( session ) );
+	CSession& added = *sessions.back();
+	++activeCount;
+	ready.push_back( index );
+
+	fcntl( inputDescriptor, F_SETFL, added.InputFlags | O_NONBLOCK );
+	fcntl( outputDescriptor, F_SETFL, added.OutputFlags | O_NONBLOCK );
+	const bool isShared = inputDescriptor == outputDescriptor;
+	epoll_event event{};
+	event.data.u64 = 2ull * index;
+	if( epoll_ctl( poller, EPOLL_CTL_ADD, inputDescriptor, &event ) == 0 ) {
+		added.IsInputWatched = true;
+	} else if( errno == EPERM ) {
+		readInput( index );
+	} else {
+		finish( index );
+		throw CInvalidArguments( "CEventLoop::Add::InvalidArguments - Input descriptor cannot be watched." );
+	}
+	event.data.u64 = 2ull * index + 1;
+	if( !isShared ) {
+		if( epoll_ctl( poller, EPOLL_CTL_ADD, outputDescriptor, &event ) == 0 ) {
+			added.IsOutputWatched = true;
+		} else if( errno != EPERM ) {
+			finish( index );
+			throw CInvalidArguments( "CEventLoop::Add::InvalidArguments - Output descriptor cannot be watched." );
+		}
+	}
+	watch( index );
+	return index;
+#else
+	throw CInvalidArguments( "CEventLoop::Add::InvalidArguments - Event loop is not supported on this platform." );
+#endif
+}
+
+// Every ready program gets one slice per round, and the descriptors are polled between rounds without
+// waiting; the loop sleeps in epoll only when no program can run. A reader that goes away must not kill the
+// process hosting the other sessions, so SIGPIPE is ignored while the loop runs and writes fail with EPIPE.
+void CEventLoop::Run()
+{
+#ifdef VM_HAS_EPOLL
+	void ( *previous )( int ) = signal( SIGPIPE, SIG_IGN );
+	try {
+		while( activeCount > 0 ) {
+			for( size_t count = ready.size(); count > 0; --count ) {
+				const unsigned index = ready.front();
+				ready.pop_front();
+				runSlice( index );
+			}
+			if( activeCount > 0 ) {
+				wait( ready.empty() );
+			}
+		}
+	} catch( ... ) {
+		signal( SIGPIPE, previous );
+		throw;
+	}
+	signal( SIGPIPE, previous );
+#endif
+}
+
+const CSessionResult& CEventLoop::GetResult( unsigned session ) const
+{
+	if( session >= sessions.size() ) {
+		throw CInvalidArguments( "CEventLoop::GetResult::InvalidArguments - Unknown session." );
+	}
+	return sessions[session]->Result;
+}
+
+void CEventLoop::runSlice( unsigned index )
+{
+	CSession& session = *sessions[index];
+	CSessionResult& result = session.Result;
+	result.Status = session.VirtualMachine->Run( quantum );
+	result.ExecutedCount = session.VirtualMachine->GetExecutedCount();
+	++result.SlicesCount;
+	if( !session.IsOutputBroken ) {
+		session.Pending += session.Output.str();
+	}
+	session.Output.str( "" );
+	switch( result.Status ) {
+		case CVirtualMachine::TStatus::BudgetExhausted:
+			session.IsBlocked = true;
+			break;
+		case CVirtualMachine::TStatus::WaitingForInput:
+			session.IsWaiting = true;
+			break;
+		case CVirtualMachine::TStatus::Exited:
+		case CVirtualMachine::TStatus::Trapped:
+			result.Error = session.VirtualMachine->GetError();
+			session.VirtualMachine.reset();
+			session.IsProgramFinished = true;
+			break;
+	}
+	writeOutput( index );
+}
+
+// Reads one chunk per event: the descriptor stays readable if there is more, and the other sessions get
+// their turn in between.
+void CEventLoop::readInput( unsigned index )
+{
+#ifdef VM_HAS_EPOLL
+	CSession& session = *sessions[index];
+	if( !session.IsInputOpen || session.IsProgramFinished ) {
+		return;
+	}
+	const bool isFile = !session.IsInputWatched;
+	for( ;; ) {
+		ssize_t count = read( session.InputDescriptor, chunk.data(), chunk.size() );
+		if( count < 0 && errno == EINTR ) {
+			continue;
+		}
+		if( count < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+			return;
+		}
+		if( count <= 0 ) {
+			session.IsInputOpen = false;
+			session.VirtualMachine->CloseInput();
+		} else {
+			session.VirtualMachine->AppendInput( std::string( chunk.data(), static_cast<size_t>( count ) ) );
+		}
+		if( session.IsWaiting ) {
+			session.IsWaiting = false;
+			ready.push_back( index );
+		}
+		if( !isFile || !session.IsInputOpen ) {
+			break;
+		}
+	}
+	watch( index );
+#endif
+}
+
+// Output that cannot be written anymore is dropped; the program itself runs on to its end. A program that ran
+// out of its quantum is ready again once no more than a chunk of its output is left.
+void CEventLoop::writeOutput( unsigned index )
+{
+#ifdef VM_HAS_EPOLL
+	CSession& session = *sessions[index];
+	size_t written = 0;
+	while( written < session.Pending.size() ) {
+		ssize_t count = write( session.OutputDescriptor, session.Pending.data() + written,
+			session.Pending.size() - written );
+		if( count < 0 && errno == EINTR ) {
+			continue;
+		}
+		if( count < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+			break;
+		}
+		if( count < 0 ) {
+			session.IsOutputBroken = true;
+			written = session.Pending.size();
+			break;
+		}
+		written += static_cast<size_t>( count );
+	}
+	session.Pending.erase( 0, written );
+	if( session.IsBlocked && session.Pending.size() <= chunkSize ) {
+		session.IsBlocked = false;
+		ready.push_back( index );
+	}
+	if( session.IsProgramFinished && session.Pending.empty() ) {
+		finish( index );
+	} else {
+		watch( index );
+	}
+#endif
+}
+
+// Input is watched while it is open and the program runs; output only while there is something to write.
+// Hang-ups are reported even with no events asked for, so a descriptor that is not needed anymore is removed.
+void CEventLoop::watch( unsigned index )
+{
+#ifdef VM_HAS_EPOLL
+	CSession& session = *sessions[index];
+	const bool isInputNeeded = session.IsInputOpen && !session.IsProgramFinished;
+	const bool isOutputNeeded = !session.IsOutputBroken;
+	const unsigned input = isInputNeeded ? static_cast<unsigned>( EPOLLIN ) : 0;
+	const unsigned output = session.Pending.empty() ? 0 : static_cast<unsigned>( EPOLLOUT );
+	if( session.InputDescriptor == session.OutputDescriptor ) {
+		update( session.InputDescriptor, 2ull * index, input | output, isInputNeeded || isOutputNeeded,
+			session.IsInputWatched );
+		return;
+	}
+	update( session.InputDescriptor, 2ull * index, input, isInputNeeded, session.IsInputWatched );
+	update( session.OutputDescriptor, 2ull * index + 1, output, isOutputNeeded, session.IsOutputWatched );
+#endif
+}
+
+void CEventLoop::update( int descriptor, unsigned long long tag, unsigned events, bool isNeeded, bool& isWatched )
+{
+#ifdef VM_HAS_EPOLL
+	if( !isWatched ) {
+		return;
+	}
+	if( !isNeeded ) {
+		epoll_ctl( poller, EPOLL_CTL_DEL, descriptor, nullptr );
+		isWatched = false;
+		return;
+	}
+	epoll_event event{};
+	event.events = events;
+	event.data.u64 = tag;
+	epoll_ctl( poller, EPOLL_CTL_MOD, descriptor, &event );
+#endif
+}
+
+// Descriptors get their original flags back before they are closed, since a terminal or an inherited pipe
+// may be shared with other processes.
+void CEventLoop::finish( unsigned index )
+{
+#ifdef VM_HAS_EPOLL
+	CSession& session = *sessions[index];
+	if( session.IsInputWatched ) {
+		epoll_ctl( poller, EPOLL_CTL_DEL, session.InputDescriptor, nullptr );
+	}
+	if( session.IsOutputWatched ) {
+		epoll_ctl( poller, EPOLL_CTL_DEL, session.OutputDescriptor, nullptr );
+	}
+	fcntl( session.InputDescriptor, F_SETFL, session.InputFlags );
+	fcntl( session.OutputDescriptor, F_SETFL, session.OutputFlags );
+	close( session.InputDescriptor );
+	if( session.OutputDescriptor != session.InputDescriptor ) {
+		close( session.OutputDescriptor );
+	}
+	session.VirtualMachine.reset();
+	session.Pending.clear();
+	session.IsInputWatched = false;
+	session.IsOutputWatched = false;
+	session.IsFinished = true;
+	--activeCount;
+#endif
+}
+
+// A hang-up on the input is left to the read, which sees it as the end of input; on the output it means that
+// nothing written will ever be read.
+void CEventLoop::wait( bool isBlocking )
+{
+#ifdef VM_HAS_EPOLL
+	epoll_event events[64];
+	int count = epoll_wait( poller, events, 64, isBlocking ? -1 : 0 );
+	for( int i = 0; i < count; ++i ) {
+		const unsigned index = static_cast<unsigned>( events[i].data.u64 / 2 );
+		CSession& session = *sessions[index];
+		const bool isOutput = events[i].data.u64 % 2 != 0 || session.InputDescriptor == session.OutputDescriptor;
+		if( events[i].data.u64 % 2 == 0 && !session.IsFinished
+			&& ( events[i].events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) != 0 )
+		{
+			readInput( index );
+		}
+		if( isOutput && !session.IsFinished && ( events[i].events & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) ) != 0 ) {
+			if( ( events[i].events & ( EPOLLHUP | EPOLLERR ) ) != 0 ) {
+				session.IsOutputBroken = true;
+				session.Pending.clear();
+			}
+			writeOutput( index );
+		}
+	}
+#endif
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "VirtualMachine.h"
+
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined( __linux__ )
+#define VM_HAS_EPOLL
+#endif
+
+struct CSessionResult {
+	CVirtualMachine::TStatus Status = CVirtualMachine::TStatus::BudgetExhausted;
+	// Message of the error that trapped the program.
+	std::string Error;
+	unsigned long long ExecutedCount = 0;
+	unsigned long long SlicesCount = 0;
+};
+
+// Hosts many interactive programs on one thread. Every session connects a program to an input and an output
+// descriptor: a pipe, a socket, a terminal or a regular file, possibly the same socket for both. Descriptors
+// are switched to nonblocking mode and watched by epoll; whatever arrives is appended to the input of the
+// program, and a program that reads past it is suspended in front of the read until more comes or the input
+// ends. Ready programs take turns running for a quantum of commands, and their output is written out as the
+// descriptors accept it, so a slow reader holds up only its own session: a program whose unwritten output
+// exceeds a chunk gets no more quanta until the descriptor takes it.
+//
+// Regular files cannot be watched and are always ready: they are read and written in place. The loop owns the
+// descriptors and closes them once the program has finished and its output is written or cannot be anymore.
+class CEventLoop {
+
+public:
+	explicit CEventLoop( unsigned long long _quantum = 1 << 16,
+		CVirtualMachine::TCore _core = CVirtualMachine::TCore::Decoded );
+	CEventLoop( const CEventLoop& ) = delete;
+	CEventLoop& operator=( const CEventLoop& ) = delete;
+	~CEventLoop();
+
+	static bool IsSupported();
+
+	// Returns the id of the session. The program is loaded at once, so errors of loading are thrown here.
+	unsigned Add( const std::string& pathToBinaryFile, int inputDescriptor, int outputDescriptor );
+	// Returns when every session has finished.
+	void Run();
+	const CSessionResult& GetResult( unsigned session ) const;
+
+private:
+	static const unsigned chunkSize = 1 << 16;
+
+	struct CSession {
+		std::unique_ptr<CVirtualMachine> VirtualMachine;
+		std::ostringstream Output;
+		int InputDescriptor = -1;
+		int OutputDescriptor = -1;
+		int InputFlags = 0;
+		int OutputFlags = 0;
+		bool IsInputWatched = false;
+		bool IsOutputWatched = false;
+		bool IsProgramFinished = false;
+		bool IsInputOpen = true;
+		bool IsOutputBroken = false;
+		bool IsWaiting = false;
+		// Ran out of its quantum and waits for its output to be written before it gets the next one.
+		bool IsBlocked = false;
+		bool IsFinished = false;
+		std::string Pending;
+		CSessionResult Result;
+	};
+
+	unsigned long long quantum;
+	CVirtualMachine::TCore core;
+	int poller = -1;
+	std::vector<std::unique_ptr<CSession>> sessions;
+	std::deque<unsigned> ready;
+	unsigned activeCount = 0;
+	std::vector<char> chunk;
+
+	void runSlice( unsigned index );
+	void readInput( unsigned index );
+	void writeOutput( unsigned index );
+	void watch( unsigned index );
+	void update( int descriptor, unsigned long long tag, unsigned events, bool isNeeded, bool& isWatched );
+	void finish( unsigned index );
+	void wait( bool isBlocking );
+};
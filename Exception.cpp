@@ -30,3 +30,29 @@ CInvalidArguments::CInvalidArguments( std::string _message ) :
 	CException( _message )
 {
 }
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CMemoryOverflow::CMemoryOverflow( std::string _message ) :
+	CException( _message )
+{
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+CStackOverflow::CStackOverflow( std::string _message, unsigned _ip, unsigned _depth ) :
+	CException( _message ),
+	ip( _ip ),
+	depth( _depth )
+{
+}
+
+unsigned CStackOverflow::GetIp() const
+{
+	return ip;
+}
+
+unsigned CStackOverflow::GetDepth() const
+{
+	return depth;
+}
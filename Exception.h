@@ -37,3 +37,26 @@ class CInvalidArguments : public CException {
 public:
 	CInvalidArguments( std::string _message );
 };
+
+//----------------------------------------------------------------------------------------------------------------------
+
+class CMemoryOverflow : public CException {
+
+public:
+	CMemoryOverflow( std::string _message );
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+class CStackOverflow : public CException {
+
+public:
+	CStackOverflow( std::string _message, unsigned _ip, unsigned _depth );
+
+	unsigned GetIp() const;
+	unsigned GetDepth() const;
+
+private:
+	unsigned ip;
+	unsigned depth;
+};
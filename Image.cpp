@@ -0,0 +1,362 @@
+#include "Exception.h"
+#include "Image.h"
+
+#include <algorithm>
+#include <fstream>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VM_HAS_MMAP
+#endif
+
+CImage::CImage()
+{
+}
+
+CImage::~CImage()
+{
+	Clear();
+}
+
+void CImage::Load( const std::string& pathToBinaryFile, bool allowMapping )
+{
+	Clear();
+	if( !allowMapping || !tryMap( pathToBinaryFile ) ) {
+		read( pathToBinaryFile );
+	}
+	if( words[0] == Magic ) {
+		unpack();
+	}
+}
+
+// A sectioned image is unpacked straight from the words given, which unpack only reads; a raw one is the memory
+// itself and is copied, since the program writes to it.
+void CImage::Load( const unsigned* fileWords, size_t wordsCount )
+{
+	Clear();
+	checkSize( static_cast<unsigned long long>( wordsCount ) * sizeof( unsigned ) );
+	if( fileWords[0] == Magic ) {
+		words = const_cast<unsigned*>( fileWords );
+		size = static_cast<unsigned>( wordsCount );
+		try {
+			unpack();
+		} catch( ... ) {
+			words = nullptr;
+			size = 0;
+			throw;
+		}
+		return;
+	}
+	storage.assign( fileWords, fileWords + wordsCount );
+	words = storage.data();
+	size = static_cast<unsigned>( wordsCount );
+}
+
+// Moves the memory to the end of an anonymous mapping followed by GuardSize inaccessible bytes, so that a write
+// past the last word faults instead of reaching other data. A mapping that already ends on a page boundary
+// right after the memory stays where it is and only gets the guard placed behind it. Memory smaller than
+// memorySize words grows to it with zeros. Returns false where memory cannot be mapped; it is grown anyway.
+bool CImage::Guard( unsigned memorySize )
+{
+	const unsigned newSize = std::max( size, memorySize );
+#ifdef VM_HAS_MMAP
+	const size_t pageSize = static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+	const size_t bytesCount = static_cast<size_t>( newSize ) * sizeof( unsigned );
+	const size_t pagesBytesCount = ( bytesCount + pageSize - 1 ) / pageSize * pageSize;
+	if( guard != nullptr && newSize == size ) {
+		return true;
+	}
+	if( mapping != nullptr && guard == nullptr && words == mapping && newSize == size && mappingSize == bytesCount
+		&& bytesCount == pagesBytesCount )
+	{
+		void* end = static_cast<char*>( mapping ) + mappingSize;
+		void* data = mmap( end, GuardSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+		if( data == end ) {
+			guard = data;
+			return true;
+		}
+		if( data != MAP_FAILED ) {
+			munmap( data, GuardSize );
+		}
+	}
+	void* data = mmap( nullptr, pagesBytesCount + GuardSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if( data != MAP_FAILED ) {
+		char* guardStart = static_cast<char*>( data ) + pagesBytesCount;
+		if( mprotect( guardStart, GuardSize, PROT_NONE ) == 0 ) {
+			unsigned* moved = reinterpret_cast<unsigned*>( guardStart - bytesCount );
+			std::copy( words, words + size, moved );
+			release();
+			mapping = data;
+			mappingSize = pagesBytesCount + GuardSize;
+			guard = guardStart;
+			words = moved;
+			size = newSize;
+			return true;
+		}
+		munmap( data, pagesBytesCount + GuardSize );
+	}
+#endif
+	if( newSize > size ) {
+		std::vector<unsigned> grown( newSize, 0 );
+		std::copy( words, words + size, grown.begin() );
+		release();
+		storage.swap( grown );
+		words = storage.data();
+		size = newSize;
+	}
+	return false;
+}
+
+const void* CImage::GetGuard() const
+{
+	return guard;
+}
+
+bool CImage::IsMapped() const
+{
+	return mapping != nullptr;
+}
+
+bool CImage::IsSectioned() const
+{
+	return isSectioned;
+}
+
+unsigned* CImage::Data()
+{
+	return words;
+}
+
+const unsigned* CImage::Data() const
+{
+	return words;
+}
+
+unsigned CImage::Size() const
+{
+	return size;
+}
+
+unsigned& CImage::operator[]( unsigned index )
+{
+	return words[index];
+}
+
+const unsigned& CImage::operator[]( unsigned index ) const
+{
+	return words[index];
+}
+
+const std::vector<CImage::CSymbol>& CImage::GetSymbols() const
+{
+	return symbols;
+}
+
+void CImage::Clear()
+{
+	release();
+	isSectioned = false;
+	symbols.clear();
+}
+
+// Maps the file privately: pages are shared with the page cache until the program writes to them. Small
+// files, such as sectioned ones, are cheaper to copy than to map and are read from the same descriptor.
+// Returns false if neither is possible, leaving the file to the fallback path.
+bool CImage::tryMap( const std::string& pathToBinaryFile )
+{
+#ifdef VM_HAS_MMAP
+	int descriptor = open( pathToBinaryFile.c_str(), O_RDONLY );
+	if( descriptor < 0 ) {
+		throw CInvalidFile( "CImage::tryMap::InvalidFile - Cannot open binary file." );
+	}
+	struct stat status;
+	if( fstat( descriptor, &status ) != 0 ) {
+		close( descriptor );
+		return false;
+	}
+	try {
+		checkSize( static_cast<unsigned long long>( status.st_size ) );
+	} catch( ... ) {
+		close( descriptor );
+		throw;
+	}
+	if( status.st_size < mappingThreshold ) {
+		bool isRead = readDescriptor( descriptor, static_cast<unsigned>( status.st_size ) );
+		close( descriptor );
+		return isRead;
+	}
+	void* data = mmap( nullptr, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0 );
+	close( descriptor );
+	if( data == MAP_FAILED ) {
+		return false;
+	}
+	mapping = data;
+	mappingSize = static_cast<size_t>( status.st_size );
+	words = static_cast<unsigned*>( data );
+	size = static_cast<unsigned>( mappingSize / sizeof( unsigned ) );
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool CImage::readDescriptor( int descriptor, unsigned bytesCount )
+{
+#ifdef VM_HAS_MMAP
+	storage.resize( bytesCount / sizeof( unsigned ) );
+	char* data = reinterpret_cast<char*>( storage.data() );
+	for( unsigned done = 0; done < bytesCount; ) {
+		ssize_t count = ::read( descriptor, data + done, bytesCount - done );
+		if( count <= 0 ) {
+			storage.clear();
+			return false;
+		}
+		done += static_cast<unsigned>( count );
+	}
+	words = storage.data();
+	size = static_cast<unsigned>( storage.size() );
+	return true;
+#else
+	return false;
+#endif
+}
+
+void CImage::read( const std::string& pathToBinaryFile )
+{
+	std::ifstream input( pathToBinaryFile, std::ios::in | std::ios::binary | std::ios::ate );
+	if( !input.is_open() ) {
+		throw CInvalidFile( "CImage::read::InvalidFile - Cannot open binary file." );
+	}
+	unsigned long long bytesCount = static_cast<unsigned long long>( input.tellg() );
+	checkSize( bytesCount );
+	storage.resize( static_cast<size_t>( bytesCount / sizeof( unsigned ) ) );
+	input.seekg( 0 );
+	if( !input.read( reinterpret_cast<char*>( storage.data() ), bytesCount ) ) {
+		throw CInvalidFile( "CImage::read::InvalidFile - Cannot read binary file." );
+	}
+	words = storage.data();
+	size = static_cast<unsigned>( storage.size() );
+}
+
+void CImage::checkSize( unsigned long long bytesCount )
+{
+	if( bytesCount % sizeof( unsigned ) != 0 || bytesCount / sizeof( unsigned ) < minSize
+		|| bytesCount / sizeof( unsigned ) > 0xFFFFFFFFull )
+	{
+		throw CInvalidFile( "CImage::checkSize::InvalidFile - Invalid size of binary file." );
+	}
+}
+
+// The whole file is validated before memory is allocated. The file itself is handed over to a local image,
+// which releases it once the sections are copied.
+void CImage::unpack()
+{
+	if( size < headerSize || words[1] != Version ) {
+		throw CInvalidFile( "CImage::unpack::InvalidFile - Unsupported version of binary file." );
+	}
+	const unsigned memorySize = words[2];
+	const unsigned sectionsCount = words[3];
+	if( memorySize < minSize || memorySize > MaxMemorySize ) {
+		throw CInvalidFile( "CImage::unpack::InvalidFile - Invalid memory size." );
+	}
+	if( sectionsCount > ( size - headerSize ) / sectionSize ) {
+		throw CInvalidFile( "CImage::unpack::InvalidFile - Invalid table of sections." );
+	}
+	for( unsigned i = 0; i < sectionsCount; ++i ) {
+		const unsigned* section = words + headerSize + i * sectionSize;
+		const unsigned type = section[0];
+		const unsigned address = section[1];
+		const unsigned length = section[2];
+		const unsigned offset = section[3];
+		if( type >= SectionsCount ) {
+			throw CInvalidFile( "CImage::unpack::InvalidFile - Unknown section." );
+		}
+		if( type != StackSection && ( offset > size || length > size - offset ) ) {
+			throw CInvalidFile( "CImage::unpack::InvalidFile - Section is out of file." );
+		}
+		if( type != SymbolsSection && ( address > memorySize || length > memorySize - address ) ) {
+			throw CInvalidFile( "CImage::unpack::InvalidFile - Section is out of memory." );
+		}
+	}
+
+	CImage file;
+	std::swap( file.words, words );
+	std::swap( file.size, size );
+	std::swap( file.mapping, mapping );
+	std::swap( file.mappingSize, mappingSize );
+	file.storage.swap( storage );
+
+	allocate( memorySize );
+	isSectioned = true;
+	for( unsigned i = 0; i < sectionsCount; ++i ) {
+		const unsigned* section = file.words + headerSize + i * sectionSize;
+		const unsigned* data = file.words + section[3];
+		if( section[0] == SymbolsSection ) {
+			readSymbols( data, section[2] );
+		} else if( section[0] != StackSection ) {
+			std::copy( data, data + section[2], words + section[1] );
+		}
+	}
+}
+
+void CImage::readSymbols( const unsigned* data, unsigned length )
+{
+	for( unsigned i = 0; i < length; ) {
+		if( length - i < 3 || data[i] >= SymbolsCount || ( data[i + 2] + 3 ) / 4 > length - i - 3 ) {
+			throw CInvalidFile( "CImage::readSymbols::InvalidFile - Invalid symbol." );
+		}
+		CSymbol symbol{ static_cast<TSymbol>( data[i] ), data[i + 1], "" };
+		const unsigned nameLength = data[i + 2];
+		i += 3;
+		for( unsigned j = 0; j < nameLength; ++j ) {
+			symbol.Name += static_cast<char>( ( data[i + j / 4] >> ( 24 - 8 * ( j % 4 ) ) ) & 0xFF );
+		}
+		i += ( nameLength + 3 ) / 4;
+		symbols.push_back( symbol );
+	}
+}
+
+// Anonymous mapping gives zeroed pages lazily, so the untouched part of a large memory costs nothing.
+void CImage::allocate( unsigned memorySize )
+{
+#ifdef VM_HAS_MMAP
+	const size_t bytesCount = static_cast<size_t>( memorySize ) * sizeof( unsigned );
+	void* data = mmap( nullptr, bytesCount, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if( data != MAP_FAILED ) {
+		mapping = data;
+		mappingSize = bytesCount;
+		words = static_cast<unsigned*>( data );
+		size = memorySize;
+		return;
+	}
+#endif
+	storage.assign( memorySize, 0 );
+	words = storage.data();
+	size = memorySize;
+}
+
+// A guard placed behind a mapping is a mapping of its own; one inside the mapping goes away with it, and
+// unmapping it first would let another thread map the freed pages before the second munmap removes them.
+void CImage::release()
+{
+#ifdef VM_HAS_MMAP
+	const char* begin = static_cast<const char*>( mapping );
+	const char* guardBegin = static_cast<const char*>( guard );
+	if( guard != nullptr && ( mapping == nullptr || guardBegin < begin || guardBegin >= begin + mappingSize ) ) {
+		munmap( guard, GuardSize );
+	}
+	if( mapping != nullptr ) {
+		munmap( mapping, mappingSize );
+	}
+#endif
+	mapping = nullptr;
+	mappingSize = 0;
+	guard = nullptr;
+	storage.clear();
+	storage.shrink_to_fit();
+	words = nullptr;
+	size = 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Memory image of a program. A raw binary file is the memory itself: its words are either mapped
+// copy-on-write or read at once, so writes made by a running program never reach the file. A sectioned
+// file is unpacked into zeroed memory of the size given in its header.
+//
+// Sectioned format, all fields are words:
+//   header:   Magic, Version, memory size, sections count
+//   sections: type, address, length, offset of the data in the file
+//   data of the sections; stack sections have none, the symbols section is not loaded into memory
+//   and holds entries of kind, address, name length in bytes and the name packed as strings are.
+class CImage {
+
+public:
+	static const unsigned Magic = 0x46424D56;
+	static const unsigned Version = 1;
+	static const unsigned MaxMemorySize = 1 << 28;
+	// Bytes of inaccessible memory that follow a guarded image.
+	static const unsigned GuardSize = 64 << 10;
+
+	enum TSection {
+		RegistersSection,
+		StringsSection,
+		LabelsSection,
+		FunctionsSection,
+		CodeSection,
+		StackSection,
+		SymbolsSection,
+		SectionsCount
+	};
+
+	enum TSymbol {
+		StringSymbol,
+		LabelSymbol,
+		FunctionSymbol,
+		SymbolsCount
+	};
+
+	struct CSymbol {
+		TSymbol Kind;
+		unsigned Address;
+		std::string Name;
+	};
+
+	CImage();
+	CImage( const CImage& ) = delete;
+	CImage& operator=( const CImage& ) = delete;
+	~CImage();
+
+	void Load( const std::string& pathToBinaryFile, bool allowMapping = true );
+	// Loads a binary file already in memory; the words are not used after the call.
+	void Load( const unsigned* fileWords, size_t wordsCount );
+	bool Guard( unsigned memorySize );
+	const void* GetGuard() const;
+	bool IsMapped() const;
+	bool IsSectioned() const;
+	unsigned* Data();
+	const unsigned* Data() const;
+	unsigned Size() const;
+	unsigned& operator[]( unsigned index );
+	const unsigned& operator[]( unsigned index ) const;
+	const std::vector<CSymbol>& GetSymbols() const;
+	void Clear();
+
+private:
+	static const unsigned minSize = 10;
+	static const unsigned headerSize = 4;
+	static const unsigned sectionSize = 4;
+	static const unsigned mappingThreshold = 64 << 10;
+	unsigned* words = nullptr;
+	unsigned size = 0;
+	void* mapping = nullptr;
+	size_t mappingSize = 0;
+	void* guard = nullptr;
+	std::vector<unsigned> storage;
+	bool isSectioned = false;
+	std::vector<CSymbol> symbols;
+
+	bool tryMap( const std::string& pathToBinaryFile );
+	bool readDescriptor( int descriptor, unsigned bytesCount );
+	void read( const std::string& pathToBinaryFile );
+	void unpack();
+	void readSymbols( const unsigned* data, unsigned length );
+	void allocate( unsigned memorySize );
+	void release();
+	static void checkSize( unsigned long long bytesCount );
+};
@@ -0,0 +1,224 @@
+#include "Exception.h"
+#include "Input.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+
+#if defined( _WIN32 )
+#include <io.h>
+#elif defined( __unix__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VM_HAS_MMAP
+#endif
+
+CInput::CInput() :
+	buffer( chunkSize )
+{
+}
+
+CInput::~CInput()
+{
+	release();
+}
+
+void CInput::SetStandardInput()
+{
+	release();
+	source = TSource::StandardInput;
+}
+
+void CInput::SetStream( std::istream& _stream )
+{
+	release();
+	source = TSource::Stream;
+	stream = &_stream;
+}
+
+// The file is mapped when the platform allows it and read at once otherwise.
+void CInput::SetFile( const std::string& path )
+{
+	release();
+	source = TSource::File;
+#ifdef VM_HAS_MMAP
+	int descriptor = open( path.c_str(), O_RDONLY );
+	if( descriptor < 0 ) {
+		throw CInvalidFile( "CInput::SetFile::InvalidFile - Cannot open input file." );
+	}
+	struct stat status;
+	if( fstat( descriptor, &status ) == 0 && status.st_size > 0 ) {
+		void* data = mmap( nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0 );
+		if( data != MAP_FAILED ) {
+			mapping = data;
+			mappingSize = static_cast<size_t>( status.st_size );
+			position = static_cast<const char*>( data );
+			end = position + mappingSize;
+			close( descriptor );
+			return;
+		}
+	}
+	close( descriptor );
+#endif
+	std::ifstream file( path, std::ios::in | std::ios::binary );
+	if( !file.is_open() ) {
+		throw CInvalidFile( "CInput::SetFile::InvalidFile - Cannot open input file." );
+	}
+	buffer.assign( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+	position = buffer.data();
+	end = position + buffer.size();
+}
+
+// The unread rest of the data is moved to the front, so the buffer only holds what is still to be read.
+void CInput::Append( const std::string& data )
+{
+	std::vector<char> joined;
+	if( source == TSource::Appended ) {
+		joined.assign( position, end );
+	} else {
+		release();
+		source = TSource::Appended;
+		isClosed = false;
+	}
+	joined.insert( joined.end(), data.begin(), data.end() );
+	buffer.swap( joined );
+	position = buffer.data();
+	end = position + buffer.size();
+}
+
+void CInput::Close()
+{
+	if( source != TSource::Appended ) {
+		Append( "" );
+	}
+	isClosed = true;
+}
+
+// A number is complete once something that is not a digit follows it; anything that is not a number at all
+// is left to ReadNumber to report.
+bool CInput::IsReady() const
+{
+	if( source != TSource::Appended || isClosed ) {
+		return true;
+	}
+	const char* current = position;
+	while( current != end && isSpace( *current ) ) {
+		++current;
+	}
+	if( current == end || !isDigit( *current ) ) {
+		return current != end;
+	}
+	while( current != end && isDigit( *current ) ) {
+		++current;
+	}
+	return current != end;
+}
+
+// Accepts decimal numbers separated by whitespace, up to 2147483647 as stated in README.
+unsigned CInput::ReadNumber()
+{
+	if( !skipSpaces() ) {
+		throw CInvalidArguments( "CInput::ReadNumber::InvalidArguments - Unexpected end of input." );
+	}
+	if( !isDigit( *position ) ) {
+		throw CInvalidArguments( "CInput::ReadNumber::InvalidArguments - Number expected." );
+	}
+	unsigned long long number = 0;
+	do {
+		number = number * 10 + ( *position - '0' );
+		if( number > maxNumber ) {
+			throw CInvalidArguments( "CInput::ReadNumber::InvalidArguments - The number is too large." );
+		}
+		++position;
+	} while( ( position != end || refill() ) && isDigit( *position ) );
+	return static_cast<unsigned>( number );
+}
+
+// Reads the next chunk into the buffer. Reads from the descriptor return as soon as some data is available,
+// and streams give what they have buffered, so interactive input is not held back until the chunk is full.
+bool CInput::refill()
+{
+	if( source == TSource::File || source == TSource::Appended ) {
+		return false;
+	}
+	if( buffer.size() < chunkSize ) {
+		buffer.resize( chunkSize );
+	}
+	long long count = 0;
+	if( source == TSource::Stream ) {
+		count = readAvailable( *stream->rdbuf() );
+	} else {
+#if defined( _WIN32 )
+		count = _read( 0, buffer.data(), chunkSize );
+#elif defined( VM_HAS_MMAP )
+		do {
+			count = read( 0, buffer.data(), chunkSize );
+		} while( count < 0 && errno == EINTR );
+#else
+		count = readAvailable( *std::cin.rdbuf() );
+#endif
+	}
+	if( count <= 0 ) {
+		position = end = buffer.data();
+		return false;
+	}
+	position = buffer.data();
+	end = position + count;
+	return true;
+}
+
+// Waits for a single character only when nothing is buffered; sgetc fills the stream's own buffer, and what
+// it holds is taken at once.
+long long CInput::readAvailable( std::streambuf& streamBuffer )
+{
+	if( streamBuffer.in_avail() <= 0 && streamBuffer.sgetc() == std::char_traits<char>::eof() ) {
+		return 0;
+	}
+	const std::streamsize available = streamBuffer.in_avail();
+	if( available <= 0 ) {
+		buffer[0] = std::char_traits<char>::to_char_type( streamBuffer.sbumpc() );
+		return 1;
+	}
+	return streamBuffer.sgetn( buffer.data(), std::min<std::streamsize>( available, chunkSize ) );
+}
+
+bool CInput::skipSpaces()
+{
+	for( ;; ) {
+		while( position != end && isSpace( *position ) ) {
+			++position;
+		}
+		if( position != end ) {
+			return true;
+		}
+		if( !refill() ) {
+			return false;
+		}
+	}
+}
+
+void CInput::release()
+{
+#ifdef VM_HAS_MMAP
+	if( mapping != nullptr ) {
+		munmap( mapping, mappingSize );
+	}
+#endif
+	mapping = nullptr;
+	mappingSize = 0;
+	stream = nullptr;
+	position = end = nullptr;
+}
+
+bool CInput::isSpace( char c )
+{
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+bool CInput::isDigit( char c )
+{
+	return c >= '0' && c <= '9';
+}
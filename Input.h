@@ -0,0 +1,53 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+// Input of the read command. Data is taken from the standard input descriptor or a stream in large chunks,
+// from a memory-mapped file, or from data appended while the program runs, and numbers are parsed without
+// iostreams.
+class CInput {
+
+public:
+	CInput();
+	CInput( const CInput& ) = delete;
+	CInput& operator=( const CInput& ) = delete;
+	~CInput();
+
+	void SetStandardInput();
+	void SetStream( std::istream& _stream );
+	void SetFile( const std::string& path );
+	// Appended data is kept in memory; a program reading past it waits for more until the input is closed.
+	void Append( const std::string& data );
+	void Close();
+	// False if a read would have to wait for appended data that is not there yet.
+	bool IsReady() const;
+	unsigned ReadNumber();
+
+private:
+	enum class TSource {
+		StandardInput,
+		Stream,
+		File,
+		Appended
+	};
+
+	static const unsigned chunkSize = 1 << 16;
+	static const unsigned maxNumber = 2147483647;
+	TSource source = TSource::StandardInput;
+	std::istream* stream = nullptr;
+	std::vector<char> buffer;
+	const char* position = nullptr;
+	const char* end = nullptr;
+	void* mapping = nullptr;
+	size_t mappingSize = 0;
+	bool isClosed = false;
+
+	bool refill();
+	long long readAvailable( std::streambuf& streamBuffer );
+	bool skipSpaces();
+	void release();
+	static bool isSpace( char c );
+	static bool isDigit( char c );
+};
@@ -0,0 +1,473 @@
+#include "Jit.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined( _WIN32 )
+#include <windows.h>
+#elif defined( __unix__ ) || defined( __APPLE__ )
+#include <sys/mman.h>
+#endif
+
+#if ( defined( __x86_64__ ) || defined( _M_X64 ) ) && ( defined( _WIN32 ) || defined( __unix__ ) || defined( __APPLE__ ) )
+#define VM_JIT_SUPPORTED
+#endif
+
+namespace {
+
+// x86-64 register numbers used in ModRM bytes.
+const unsigned char eax = 0;
+const unsigned char ecx = 1;
+
+// Condition codes of jcc.
+const unsigned char always = 0xFF;
+const unsigned char below = 0x2;
+const unsigned char aboveOrEqual = 0x3;
+const unsigned char equal = 0x4;
+
+// push rbx; push rsi; mov rbx, <first argument>; mov esi, [rbx + 4]
+#if defined( _WIN32 )
+const unsigned char prologue[] = { 0x53, 0x56, 0x48, 0x89, 0xCB, 0x8B, 0x73, 0x04 };
+#else
+const unsigned char prologue[] = { 0x53, 0x56, 0x48, 0x89, 0xFB, 0x8B, 0x73, 0x04 };
+#endif
+
+const unsigned neverCompile = ~0u;
+
+} // namespace
+
+CJit::CJit()
+{
+}
+
+CJit::~CJit()
+{
+	if( buffer == nullptr ) {
+		return;
+	}
+#if defined( _WIN32 )
+	VirtualFree( buffer, 0, MEM_RELEASE );
+#elif defined( VM_JIT_SUPPORTED )
+	munmap( buffer, bufferSize );
+#endif
+}
+
+bool CJit::IsSupported()
+{
+#ifdef VM_JIT_SUPPORTED
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Label targets are collected once from the resolved targets of decoded if and call commands, so that
+// compiled blocks stop where other control flow joins in.
+void CJit::Init( const CDecodedProgram& program, const CImage& code )
+{
+#ifdef VM_JIT_SUPPORTED
+	if( buffer == nullptr ) {
+#if defined( _WIN32 )
+		void* memory = VirtualAlloc( nullptr, bufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE );
+		buffer = static_cast<unsigned char*>( memory );
+#else
+		void* memory = mmap( nullptr, bufferSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+		buffer = memory == MAP_FAILED ? nullptr : static_cast<unsigned char*>( memory );
+#endif
+	}
+#endif
+	used = 0;
+	executed = 0;
+	compiledCount = 0;
+	limit = program.GetLimit();
+	size = code.Size();
+	entries.assign( size, nullptr );
+	hotness.assign( size, 0 );
+	targets.assign( size, false );
+	blocks.clear();
+
+	const CDecodedCommand* commands = program.Data();
+	for( unsigned i = 0; i < limit; ++i ) {
+		unsigned target = size;
+		switch( commands[i].Operation ) {
+			case CDecodedProgram::IfImmediate:
+			case CDecodedProgram::IfRegister:
+				target = commands[i].Argument3;
+				break;
+			case CDecodedProgram::Call:
+				target = commands[i].Argument2;
+				break;
+		}
+		if( target < size ) {
+			targets[target] = true;
+		}
+	}
+}
+
+CJit::TBlock CJit::Prepare( unsigned ip, const CDecodedProgram& program )
+{
+	if( ip >= size ) {
+		return nullptr;
+	}
+	if( entries[ip] != nullptr ) {
+		return entries[ip];
+	}
+	if( hotness[ip] == neverCompile || ++hotness[ip] < compileThreshold ) {
+		return nullptr;
+	}
+	entries[ip] = compile( ip, program );
+	if( entries[ip] == nullptr ) {
+		hotness[ip] = neverCompile;
+	}
+	return entries[ip];
+}
+
+// Returns true if compiled code stopped in front of a command that the interpreter has to execute.
+bool CJit::Execute( TBlock block, unsigned* memory )
+{
+#ifdef VM_JIT_SUPPORTED
+	typedef unsigned ( *TNative )( unsigned* memory );
+	TNative native = reinterpret_cast<TNative>( static_cast<unsigned char*>( block ) - sizeof( prologue ) );
+	return native( memory ) != 0;
+#else
+	return true;
+#endif
+}
+
+unsigned long long CJit::TakeExecutedCount()
+{
+	unsigned long long count = executed;
+	executed = 0;
+	return count;
+}
+
+void CJit::SetBudget( unsigned long long _budget )
+{
+	budget = _budget;
+}
+
+// Blocks are never freed, they are only unlinked from the entry table, so any chain leading to them
+// goes back to the interpreter from now on.
+void CJit::Invalidate( unsigned address )
+{
+	if( address >= limit ) {
+		return;
+	}
+	for( CBlockRange& block : blocks ) {
+		if( block.Start <= address && address < block.End ) {
+			entries[block.Start] = nullptr;
+			hotness[block.Start] = 0;
+			block.End = block.Start;
+		}
+	}
+}
+
+unsigned CJit::GetCompiledCount() const
+{
+	return compiledCount;
+}
+
+void CJit::Clear()
+{
+	used = 0;
+	limit = 0;
+	size = 0;
+	executed = 0;
+	budget = ~0ull;
+	entries.clear();
+	hotness.clear();
+	targets.clear();
+	blocks.clear();
+	stubs.clear();
+	compiledCount = 0;
+}
+
+CJit::TBlock CJit::compile( unsigned start, const CDecodedProgram& program )
+{
+	if( buffer == nullptr || used + maxBlockSize > bufferSize ) {
+		return nullptr;
+	}
+	const unsigned blockStart = used;
+	stubs.clear();
+	for( unsigned char byte : prologue ) {
+		emitByte( byte );
+	}
+	unsigned char* body = buffer + used;
+
+	const CDecodedCommand* commands = program.Data();
+	unsigned ip = start;
+	unsigned count = 0;
+	bool terminated = false;
+	while( ip < limit && ( count == 0 || !targets[ip] ) && count < maxBlockLength ) {
+		if( !emitCommand( CDecodedProgram::Split( commands[ip] ), ip, count, terminated ) ) {
+			break;
+		}
+		++count;
+		if( terminated ) {
+			break;
+		}
+		ip += 3;
+	}
+	if( count == 0 ) {
+		used = blockStart;
+		return nullptr;
+	}
+	if( terminated ) {
+		ip += 3;
+	} else {
+		emitBytes( { 0xB8 } ); // mov eax, ip
+		emitDword( ip );
+		emitExit( count );
+	}
+	emitStubs();
+
+	blocks.push_back( CBlockRange{ start, ip } );
+	++compiledCount;
+	return body;
+}
+
+// Emits native code for one decoded command. Returns false, emitting nothing, for commands that are left
+// to the interpreter; sets terminated for commands that transfer control.
+bool CJit::emitCommand( const CDecodedCommand& command, unsigned ip, unsigned count, bool& terminated )
+{
+	const unsigned operation = command.Operation;
+	switch( operation ) {
+		case CDecodedProgram::PushImmediate:
+		case CDecodedProgram::Pushaddr:
+			emitCheckStack( false, ip, count );
+			emitBytes( { 0xC7, 0x04, 0xB3 } ); // mov dword [rbx + rsi * 4], value
+			emitDword( ( operation == CDecodedProgram::Pushaddr ? ip + 6 : command.Argument1 ) + integerShift );
+			emitBytes( { 0xFF, 0xC6 } ); // inc esi
+			return true;
+		case CDecodedProgram::PushRegister:
+			emitLoadValue( eax, command.Argument1, false, ip, count );
+			emitCheckStack( false, ip, count );
+			emitBytes( { 0x89, 0x04, 0xB3 } ); // mov [rbx + rsi * 4], eax
+			emitBytes( { 0xFF, 0xC6 } ); // inc esi
+			return true;
+		case CDecodedProgram::Pop:
+			emitCheckStack( true, ip, count );
+			emitBytes( { 0xFF, 0xCE } ); // dec esi
+			emitBytes( { 0x8B, 0x04, 0xB3 } ); // mov eax, [rbx + rsi * 4]
+			emitStoreMemory( eax, resIndex );
+			emitBytes( { 0xC7, 0x04, 0xB3 } ); // mov dword [rbx + rsi * 4], 0
+			emitDword( 0 );
+			return true;
+		case CDecodedProgram::MoveImmediate:
+		case CDecodedProgram::MoveRegister:
+			emitLoadValue( eax, command.Argument1, operation == CDecodedProgram::MoveImmediate, ip, count );
+			emitStoreMemory( eax, command.Argument2 );
+			return true;
+		case CDecodedProgram::IfImmediate:
+		case CDecodedProgram::IfRegister:
+		{
+			emitLoadValue( eax, command.Argument1, operation == CDecodedProgram::IfImmediate, ip, count );
+			emitBytes( { 0x3D } ); // cmp eax, 0
+			emitDword( integerShift );
+			unsigned notTaken = emitJump( equal );
+			emitBytes( { 0xB8 } ); // mov eax, target
+			emitDword( command.Argument3 );
+			emitExit( count + 1 );
+			patchJump( notTaken );
+			emitBytes( { 0xB8 } ); // mov eax, ip + 3
+			emitDword( ip + 3 );
+			emitExit( count + 1 );
+			terminated = true;
+			return true;
+		}
+		case CDecodedProgram::Call:
+			emitBytes( { 0xB8 } ); // mov eax, target
+			emitDword( command.Argument2 );
+			emitExit( count + 1 );
+			terminated = true;
+			return true;
+		case CDecodedProgram::Return:
+			emitLoadValue( eax, resIndex, false, ip, count );
+			emitBytes( { 0x35 } ); // xor eax, integerShift
+			emitDword( integerShift );
+			emitExit( count + 1 );
+			terminated = true;
+			return true;
+	}
+
+	if( operation >= CDecodedProgram::EqualImmediateImmediate && operation <= CDecodedProgram::SubtractRegisterRegister ) {
+		emitLoadValue( eax, command.Argument1, isImmediateFirst( operation, CDecodedProgram::EqualImmediateImmediate ),
+			ip, count );
+		emitLoadValue( ecx, command.Argument2, isImmediateSecond( operation, CDecodedProgram::EqualImmediateImmediate ),
+			ip, count );
+		if( operation <= CDecodedProgram::EqualRegisterRegister ) {
+			emitBytes( { 0x39, 0xC8 } ); // cmp eax, ecx
+			emitBytes( { 0x0F, 0x94, 0xC0 } ); // sete al
+			emitBytes( { 0x0F, 0xB6, 0xC0 } ); // movzx eax, al
+		} else if( operation <= CDecodedProgram::AddRegisterRegister ) {
+			emitBytes( { 0x01, 0xC8 } ); // add eax, ecx
+		} else {
+			emitBytes( { 0x39, 0xC8 } ); // cmp eax, ecx
+			emitBail( below, ip, count );
+			emitBytes( { 0x29, 0xC8 } ); // sub eax, ecx
+		}
+		emitBytes( { 0x35 } ); // xor eax, integerShift
+		emitDword( integerShift );
+		emitStoreMemory( eax, resIndex );
+		return true;
+	}
+	return false;
+}
+
+// Loads a tagged operand into reg. Register values without the tag need the recursive lookup of the
+// interpreter, so they leave compiled code.
+void CJit::emitLoadValue( unsigned char reg, unsigned argument, bool isImmediate, unsigned ip, unsigned count )
+{
+	if( isImmediate ) {
+		emitByte( 0xB8 + reg ); // mov reg, argument + integerShift
+		emitDword( argument + integerShift );
+		return;
+	}
+	emitLoadMemory( reg, argument );
+	emitBytes( { 0x81, static_cast<unsigned char>( 0xF8 + reg ) } ); // cmp reg, integerShift
+	emitDword( integerShift );
+	emitBail( below, ip, count );
+}
+
+// Leaves compiled code unless the word written by a push (or read and cleared by a pop) lies in
+// [limit, size): lower words may hold decoded commands or registers, higher ones are outside of memory.
+void CJit::emitCheckStack( bool isPop, unsigned ip, unsigned count )
+{
+	if( isPop ) {
+		emitBytes( { 0x8D, 0x56, 0xFF } ); // lea edx, [rsi - 1]
+	} else {
+		emitBytes( { 0x89, 0xF2 } ); // mov edx, esi
+	}
+	emitBytes( { 0x81, 0xEA } ); // sub edx, limit
+	emitDword( limit );
+	emitBytes( { 0x81, 0xFA } ); // cmp edx, size - limit
+	emitDword( size - limit );
+	emitBail( aboveOrEqual, ip, count );
+}
+
+// Leaves the block with the next ip in eax: stores ip and sp, accounts executed commands and jumps
+// straight into the block compiled for the next ip if there is one and the budget is not spent.
+void CJit::emitExit( unsigned count )
+{
+	emitBytes( { 0x89, 0x03 } ); // mov [rbx], eax
+	emitBytes( { 0x89, 0x73, 0x04 } ); // mov [rbx + 4], esi
+	emitBytes( { 0x48, 0xB9 } ); // mov rcx, &executed
+	emitQword( reinterpret_cast<unsigned long long>( &executed ) );
+	emitBytes( { 0x48, 0x81, 0x01 } ); // add qword [rcx], count
+	emitDword( count );
+	emitBytes( { 0x48, 0xBA } ); // mov rdx, &budget
+	emitQword( reinterpret_cast<unsigned long long>( &budget ) );
+	emitBytes( { 0x48, 0x8B, 0x12 } ); // mov rdx, [rdx]
+	emitBytes( { 0x48, 0x39, 0x11 } ); // cmp [rcx], rdx
+	unsigned spent = emitJump( aboveOrEqual );
+	emitBytes( { 0x3D } ); // cmp eax, size
+	emitDword( size );
+	unsigned outside = emitJump( aboveOrEqual );
+	emitBytes( { 0x48, 0xB9 } ); // mov rcx, entries
+	emitQword( reinterpret_cast<unsigned long long>( entries.data() ) );
+	emitBytes( { 0x48, 0x8B, 0x0C, 0xC1 } ); // mov rcx, [rcx + rax * 8]
+	emitBytes( { 0x48, 0x85, 0xC9 } ); // test rcx, rcx
+	unsigned notCompiled = emitJump( equal );
+	emitBytes( { 0xFF, 0xE1 } ); // jmp rcx
+	patchJump( spent );
+	patchJump( outside );
+	patchJump( notCompiled );
+	emitBytes( { 0x31, 0xC0 } ); // xor eax, eax
+	emitEpilogue();
+}
+
+void CJit::emitBail( unsigned char condition, unsigned ip, unsigned count )
+{
+	stubs.push_back( CExitStub{ emitJump( condition ), ip, count } );
+}
+
+// Bail-outs are placed after the block body to keep the fast path straight.
+void CJit::emitStubs()
+{
+	for( const CExitStub& stub : stubs ) {
+		patchJump( stub.Jump );
+		emitBytes( { 0xC7, 0x03 } ); // mov dword [rbx], ip
+		emitDword( stub.Ip );
+		emitBytes( { 0x89, 0x73, 0x04 } ); // mov [rbx + 4], esi
+		emitBytes( { 0x48, 0xB9 } ); // mov rcx, &executed
+		emitQword( reinterpret_cast<unsigned long long>( &executed ) );
+		emitBytes( { 0x48, 0x81, 0x01 } ); // add qword [rcx], count
+		emitDword( stub.Executed );
+		emitBytes( { 0xB8 } ); // mov eax, 1
+		emitDword( 1 );
+		emitEpilogue();
+	}
+	stubs.clear();
+}
+
+void CJit::emitEpilogue()
+{
+	emitBytes( { 0x5E, 0x5B, 0xC3 } ); // pop rsi; pop rbx; ret
+}
+
+// Emits a jump with a 32-bit displacement to be patched later and returns the position of the displacement.
+unsigned CJit::emitJump( unsigned char condition )
+{
+	if( condition == always ) {
+		emitByte( 0xE9 );
+	} else {
+		emitBytes( { 0x0F, static_cast<unsigned char>( 0x80 + condition ) } );
+	}
+	unsigned jump = used;
+	emitDword( 0 );
+	return jump;
+}
+
+void CJit::patchJump( unsigned jump )
+{
+	unsigned displacement = used - ( jump + 4 );
+	std::memcpy( buffer + jump, &displacement, sizeof( displacement ) );
+}
+
+void CJit::emitLoadMemory( unsigned char reg, unsigned address )
+{
+	emitBytes( { 0x8B, static_cast<unsigned char>( 0x83 + ( reg << 3 ) ) } ); // mov reg, [rbx + address * 4]
+	emitDword( address * 4 );
+}
+
+void CJit::emitStoreMemory( unsigned char reg, unsigned address )
+{
+	emitBytes( { 0x89, static_cast<unsigned char>( 0x83 + ( reg << 3 ) ) } ); // mov [rbx + address * 4], reg
+	emitDword( address * 4 );
+}
+
+void CJit::emitByte( unsigned char byte )
+{
+	buffer[used++] = byte;
+}
+
+void CJit::emitBytes( std::initializer_list<unsigned char> bytes )
+{
+	for( unsigned char byte : bytes ) {
+		emitByte( byte );
+	}
+}
+
+void CJit::emitDword( unsigned value )
+{
+	std::memcpy( buffer + used, &value, sizeof( value ) );
+	used += sizeof( value );
+}
+
+void CJit::emitQword( unsigned long long value )
+{
+	std::memcpy( buffer + used, &value, sizeof( value ) );
+	used += sizeof( value );
+}
+
+// The four specializations of a binary command go in the order immediate-immediate, immediate-register,
+// register-immediate, register-register.
+bool CJit::isImmediateFirst( unsigned operation, unsigned first )
+{
+	return ( ( operation - first ) % 4 ) < 2;
+}
+
+bool CJit::isImmediateSecond( unsigned operation, unsigned first )
+{
+	return ( ( operation - first ) % 4 ) % 2 == 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "DecodedProgram.h"
+
+#include <vector>
+
+// Baseline compiler of hot basic blocks to x86-64 code. Blocks start where control lands after if, call
+// and return, end at the next control transfer, at the next label target or before the first command they
+// cannot handle, and are chained to each other through a table indexed by ip. Compiled code works on the
+// memory image directly (ip, sp and registers in code[0..9]) and gives control back to the interpreter
+// whenever a command needs the general path: untagged register values, stack words below the decode limit,
+// subtraction underflow.
+class CJit {
+
+public:
+	typedef void* TBlock;
+
+	CJit();
+	CJit( const CJit& ) = delete;
+	CJit& operator=( const CJit& ) = delete;
+	~CJit();
+
+	static bool IsSupported();
+
+	void Init( const CDecodedProgram& program, const CImage& code );
+	TBlock Prepare( unsigned ip, const CDecodedProgram& program );
+	bool Execute( TBlock block, unsigned* memory );
+	unsigned long long TakeExecutedCount();
+	// Chained blocks give control back once this many commands are executed since the last count was taken.
+	void SetBudget( unsigned long long _budget );
+	void Invalidate( unsigned address );
+	unsigned GetCompiledCount() const;
+	void Clear();
+
+private:
+	static const unsigned integerShift = 1 << 31;
+	static const unsigned resIndex = 9;
+	static const unsigned compileThreshold = 16;
+	static const unsigned maxBlockLength = 256;
+	static const unsigned bufferSize = 4 << 20;
+	static const unsigned maxBlockSize = 256 * maxBlockLength + 512;
+
+	struct CBlockRange {
+		unsigned Start;
+		unsigned End;
+	};
+
+	struct CExitStub {
+		unsigned Jump;
+		unsigned Ip;
+		unsigned Executed;
+	};
+
+	unsigned char* buffer = nullptr;
+	unsigned used = 0;
+	unsigned limit = 0;
+	unsigned size = 0;
+	unsigned long long executed = 0;
+	unsigned long long budget = ~0ull;
+	std::vector<TBlock> entries;
+	std::vector<unsigned> hotness;
+	std::vector<bool> targets;
+	std::vector<CBlockRange> blocks;
+	std::vector<CExitStub> stubs;
+	unsigned compiledCount = 0;
+
+	TBlock compile( unsigned start, const CDecodedProgram& program );
+	bool emitCommand( const CDecodedCommand& command, unsigned ip, unsigned count, bool& terminated );
+	void emitLoadValue( unsigned char reg, unsigned argument, bool isImmediate, unsigned ip, unsigned count );
+	void emitCheckStack( bool isPop, unsigned ip, unsigned count );
+	void emitExit( unsigned count );
+	void emitBail( unsigned char condition, unsigned ip, unsigned count );
+	void emitStubs();
+	void emitEpilogue();
+	unsigned emitJump( unsigned char condition );
+	void patchJump( unsigned jump );
+	void emitLoadMemory( unsigned char reg, unsigned address );
+	void emitStoreMemory( unsigned char reg, unsigned address );
+	void emitByte( unsigned char byte );
+	void emitBytes( std::initializer_list<unsigned char> bytes );
+	void emitDword( unsigned value );
+	void emitQword( unsigned long long value );
+	static bool isImmediateFirst( unsigned operation, unsigned first );
+	static bool isImmediateSecond( unsigned operation, unsigned first );
+};
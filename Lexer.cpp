@@ -0,0 +1,136 @@
+#include "Exception.h"
+#include "Lexer.h"
+
+#include <fstream>
+#include <iterator>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VM_HAS_MMAP
+#endif
+
+CLexer::CLexer()
+{
+}
+
+CLexer::~CLexer()
+{
+	Close();
+}
+
+void CLexer::Open( const std::string& path )
+{
+	Close();
+#ifdef VM_HAS_MMAP
+	int descriptor = open( path.c_str(), O_RDONLY );
+	if( descriptor < 0 ) {
+		throw CInvalidFile( "CLexer::Open::InvalidFile - Cannot open assembler file." );
+	}
+	struct stat status;
+	if( fstat( descriptor, &status ) == 0 && status.st_size > 0 ) {
+		void* data = mmap( nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0 );
+		if( data != MAP_FAILED ) {
+			mapping = data;
+			mappingSize = static_cast<size_t>( status.st_size );
+			position = static_cast<const char*>( data );
+			end = position + mappingSize;
+			lineStart = position;
+			close( descriptor );
+			return;
+		}
+	}
+	close( descriptor );
+#endif
+	std::ifstream file( path, std::ios::in | std::ios::binary );
+	if( !file.is_open() ) {
+		throw CInvalidFile( "CLexer::Open::InvalidFile - Cannot open assembler file." );
+	}
+	buffer.assign( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+	position = buffer.data();
+	end = position + buffer.size();
+	lineStart = position;
+}
+
+void CLexer::OpenSource( std::string_view source )
+{
+	Close();
+	position = source.data();
+	end = position + source.size();
+	lineStart = position;
+}
+
+void CLexer::Close()
+{
+#ifdef VM_HAS_MMAP
+	if( mapping != nullptr ) {
+		munmap( mapping, mappingSize );
+	}
+#endif
+	mapping = nullptr;
+	mappingSize = 0;
+	buffer.clear();
+	position = nullptr;
+	end = nullptr;
+	lineStart = nullptr;
+	line = 1;
+	tokenLine = 0;
+	tokenColumn = 0;
+}
+
+// Every read of a token expects one, so the end of the file is a syntax error here.
+std::string_view CLexer::Next()
+{
+	for( ; position != end && isSpace( *position ); ++position ) {
+		if( *position == '\n' ) {
+			++line;
+			lineStart = position + 1;
+		}
+	}
+	if( position == end ) {
+		throw CSyntaxError( "CLexer::Next::SyntaxError - Unexpected end of file." );
+	}
+	const char* begin = position;
+	while( position != end && !isSpace( *position ) ) {
+		++position;
+	}
+	tokenLine = line;
+	tokenColumn = static_cast<unsigned>( begin - lineStart ) + 1;
+	return std::string_view( begin, static_cast<size_t>( position - begin ) );
+}
+
+// Skips the single character that follows the previous token and returns the rest of its line, the text of a
+// string definition. The line break is consumed but not returned.
+std::string_view CLexer::RestOfLine()
+{
+	if( position != end ) {
+		if( *position == '\n' ) {
+			++line;
+			lineStart = position + 1;
+		}
+		++position;
+	}
+	const char* begin = position;
+	while( position != end && *position != '\n' ) {
+		++position;
+	}
+	std::string_view rest( begin, static_cast<size_t>( position - begin ) );
+	if( position != end ) {
+		++position;
+		++line;
+		lineStart = position;
+	}
+	return rest;
+}
+
+std::string CLexer::GetPosition() const
+{
+	return "line " + std::to_string( tokenLine ) + ", column " + std::to_string( tokenColumn );
+}
+
+bool CLexer::isSpace( char c )
+{
+	return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
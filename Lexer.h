@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Tokens of an assembler source. The file is mapped (or read at once where mapping is not possible) and every
+// token is a view into it, valid until the lexer is closed or opens another file; a source given in memory is
+// read in place and has to outlive its tokens. Tokens are separated by whitespace; lines and columns are
+// counted from 1.
+class CLexer {
+
+public:
+	CLexer();
+	CLexer( const CLexer& ) = delete;
+	CLexer& operator=( const CLexer& ) = delete;
+	~CLexer();
+
+	void Open( const std::string& path );
+	void OpenSource( std::string_view source );
+	void Close();
+	std::string_view Next();
+	std::string_view RestOfLine();
+	std::string GetPosition() const;
+
+private:
+	const char* position = nullptr;
+	const char* end = nullptr;
+	const char* lineStart = nullptr;
+	unsigned line = 1;
+	unsigned tokenLine = 0;
+	unsigned tokenColumn = 0;
+	void* mapping = nullptr;
+	size_t mappingSize = 0;
+	std::vector<char> buffer;
+
+	static bool isSpace( char c );
+};
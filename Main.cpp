@@ -1,22 +1,182 @@
 #include "Assembler.h"
+#include "Benchmark.h"
+#include "BenchmarkSuite.h"
+#include "CompileCache.h"
 #include "Disassembler.h"
+#include "EventLoop.h"
+#include "Scheduler.h"
 #include "VirtualMachine.h"
 
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
 
 int main( int argc, char** argv )
 {
 	try {
+		if( argc > 1 && std::string( argv[1] ) == "--benchmark" ) {
+			CBenchmark benchmark( std::cout );
+			benchmark.Run( "../fibonacci.asm", argc > 2 ? argv[2] : "25", 5 );
+			return 0;
+		}
+		if( argc > 1 && std::string( argv[1] ) == "--profile" ) {
+			CAssembler assembler;
+			assembler.Assembly( "../fibonacci.asm", "../fibonacci.bin" );
+			CProfiler profiler;
+			CCallProfiler callProfiler;
+			CVirtualMachine virtualMachine;
+			virtualMachine.SetProfiler( &profiler );
+			virtualMachine.SetCallProfiler( &callProfiler );
+			virtualMachine.Execute( "../fibonacci.bin" );
+			profiler.WriteReport( std::cout );
+			callProfiler.WriteReport( std::cout );
+			std::ofstream dump( "../fibonacci.profile" );
+			profiler.WriteDump( dump );
+			std::ofstream folded( "../fibonacci.folded" );
+			callProfiler.WriteFolded( folded );
+			return 0;
+		}
+		if( argc > 1 && std::string( argv[1] ) == "--counters" ) {
+			CAssembler assembler;
+			assembler.Assembly( "../fibonacci.asm", "../fibonacci.bin" );
+			CPerfCounters counters( argc > 2 && std::string( argv[2] ) == "per-command" );
+			CVirtualMachine virtualMachine;
+			virtualMachine.SetPerfCounters( &counters );
+			virtualMachine.Execute( "../fibonacci.bin" );
+			counters.WriteReport( std::cout );
+			return 0;
+		}
+		if( argc > 2 && std::string( argv[1] ) == "--memoize" ) {
+			// Checks that the cache does not change what a program prints, e.g. ../benchmarks/memoize-paths.asm.
+			CAssembler assembler;
+			assembler.Assembly( argv[2], "../memoize.bin" );
+			std::string outputs[2];
+			CMemoizer memoizer;
+			for( int i = 0; i < 2; ++i ) {
+				std::istringstream input( argc > 3 ? argv[3] : "" );
+				std::ostringstream output;
+				CVirtualMachine virtualMachine;
+				virtualMachine.SetInput( input );
+				virtualMachine.SetOutput( output, COutput::TFlushPolicy::Exit );
+				virtualMachine.SetMemoizer( i == 0 ? nullptr : &memoizer );
+				virtualMachine.Execute( "../memoize.bin" );
+				outputs[i] = output.str();
+			}
+			memoizer.WriteReport( std::cout );
+			std::cout << "output " << ( outputs[0] == outputs[1] ? "matches" : "differs from" ) << " the plain run" << std::endl;
+			return outputs[0] == outputs[1] ? 0 : 1;
+		}
+		if( argc > 1 && std::string( argv[1] ) == "--memoize" ) {
+			CAssembler assembler;
+			assembler.Assembly( "../fibonacci.asm", "../fibonacci.bin" );
+			CMemoizer memoizer;
+			CVirtualMachine virtualMachine;
+			virtualMachine.SetMemoizer( &memoizer );
+			virtualMachine.Execute( "../fibonacci.bin" );
+			memoizer.WriteReport( std::cout );
+			return 0;
+		}
+		if( argc > 1 && ( std::string( argv[1] ) == "--record" || std::string( argv[1] ) == "--replay" ) ) {
+			CAssembler assembler;
+			assembler.Assembly( "../fibonacci.asm", "../fibonacci.bin" );
+			CTrace trace( std::string( argv[1] ) == "--record" ? CTrace::TMode::Record : CTrace::TMode::Replay,
+				argc > 2 ? argv[2] : "../fibonacci.trace" );
+			CVirtualMachine virtualMachine;
+			virtualMachine.SetTrace( &trace );
+			virtualMachine.Execute( "../fibonacci.bin" );
+			std::cout << trace.GetBranchesCount() << " transfers, " << trace.GetInputsCount() << " inputs" << std::endl;
+			return 0;
+		}
+		if( argc > 2 && std::string( argv[1] ) == "--quantum" ) {
+			// Checks that a program that never ends gives control back, e.g. ../benchmarks/overwritten-loop.asm.
+			CAssembler assembler;
+			assembler.Assembly( argv[2], "../quantum.bin" );
+			bool isExhausted = true;
+			for( CVirtualMachine::TCore core : { CVirtualMachine::TCore::Decoded, CVirtualMachine::TCore::Jit } ) {
+				CVirtualMachine virtualMachine( core );
+				virtualMachine.Load( "../quantum.bin" );
+				const bool isCoreExhausted = virtualMachine.Run( 1000 ) == CVirtualMachine::TStatus::BudgetExhausted;
+				std::cout << CBenchmark::GetCoreName( core ) << ": " << virtualMachine.GetExecutedCount() << " instructions, "
+					<< ( isCoreExhausted ? "budget exhausted" : "did not stop at the budget" ) << std::endl;
+				isExhausted = isExhausted && isCoreExhausted;
+			}
+			return isExhausted ? 0 : 1;
+		}
+		if( argc > 1 && std::string( argv[1] ) == "--schedule" ) {
+			CAssembler assembler;
+			assembler.Assembly( "../fibonacci.asm", "../fibonacci.bin" );
+			CScheduler scheduler;
+			const unsigned tasksCount = argc > 2 ? std::stoul( argv[2] ) : 1000;
+			for( unsigned i = 0; i < tasksCount; ++i ) {
+				scheduler.Add( "../fibonacci.bin", std::to_string( 10 + i % 16 ) );
+			}
+			scheduler.Run();
+			unsigned long long executedCount = 0;
+			unsigned long long slicesCount = 0;
+			for( unsigned i = 0; i < tasksCount; ++i ) {
+				executedCount += scheduler.GetResult( i ).ExecutedCount;
+				slicesCount += scheduler.GetResult( i ).SlicesCount;
+			}
+			std::cout << tasksCount << " programs, " << slicesCount << " slices, " << executedCount << " instructions, "
+				<< scheduler.GetWallTime() << " s" << std::endl;
+			return 0;
+		}
+		if( argc > 1 && std::string( argv[1] ) == "--event-loop" ) {
+			CAssembler assembler;
+			assembler.Assembly( "../fibonacci.asm", "../fibonacci.bin" );
+			CEventLoop loop;
+			loop.Add( "../fibonacci.bin", 0, 1 );
+			loop.Run();
+			// The standard output belongs to the loop and is closed by now.
+			std::cerr << loop.GetResult( 0 ).Error;
+			return 0;
+		}
+		if( argc > 1 && std::string( argv[1] ) == "--cached" ) {
+			CCompileCache cache( argc > 2 ? argv[2] : "../.vm-cache" );
+			cache.Assembly( "../fibonacci.asm", "../fibonacci.bin" );
+			CVirtualMachine virtualMachine;
+			virtualMachine.Execute( "../fibonacci.bin" );
+			std::cout << ( cache.GetHitsCount() > 0 ? "cache hit" : "cache miss" ) << std::endl;
+			return 0;
+		}
+		if( argc > 1 && std::string( argv[1] ) == "--suite" ) {
+			CBenchmarkSuite suite( std::cout );
+			suite.AddProgram( "fibonacci", "../fibonacci.asm", "24" );
+			suite.AddProgram( "loop", "../benchmarks/loop.asm", "2000000" );
+			suite.AddProgram( "stack", "../benchmarks/stack.asm", "100 10000" );
+			suite.AddProgram( "recursion", "../benchmarks/recursion.asm", "50 20000" );
+			suite.AddProgram( "strings", "../benchmarks/strings.asm", "20000" );
+			suite.AddGeneratedProgram( "large", "../benchmarks/large.generated.asm", 800 );
+			suite.Run();
+			std::ofstream json( argc > 2 ? argv[2] : "../benchmark.json" );
+			suite.WriteJson( json );
+			return 0;
+		}
+		if( argc > 1 && std::string( argv[1] ) == "--batch" ) {
+			CBenchmark benchmark( std::cout );
+			const bool isMatching = benchmark.RunBatch( "../fibonacci.asm", { "20", "25", "15", "22", "10", "24" },
+				argc > 2 ? std::stoul( argv[2] ) : 64 );
+			return isMatching ? 0 : 1;
+		}
+
+		CAssemblerOptions options;
+		options.Optimize = argc > 1 && std::string( argv[1] ) == "-O";
+		// The program goes through assembly, execution and back without touching the disk.
+		std::ifstream file( "../fibonacci.asm", std::ios::in | std::ios::binary );
+		const std::string source( ( std::istreambuf_iterator<char>( file ) ), std::istreambuf_iterator<char>() );
 		CAssembler assembler;
-		assembler.Assembly( "../fibonacci.asm", "../fibonacci.bin" );
+		std::vector<unsigned> image = assembler.AssemblySource( source, options );
 
 		CVirtualMachine virtualMachine;
-		virtualMachine.Execute( "../fibonacci.bin" );
+		virtualMachine.ExecuteImage( image.data(), image.size() );
 
 		CDisassembler disassembler;
-		disassembler.Disassembly( "../fibonacci.bin", "../fibonacci.disasm" );
-		assembler.Assembly( "../fibonacci.disasm", "../fibonacci.bin" );
-		virtualMachine.Execute( "../fibonacci.bin" );
+		const std::string disassembled = disassembler.DisassemblyImage( image.data(), image.size() );
+		image = assembler.AssemblySource( disassembled, options );
+		virtualMachine.ExecuteImage( image.data(), image.size() );
 	} catch ( const std::exception& exception ) {
 		std::cout << exception.what() << std::endl;
 	}
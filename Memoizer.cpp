@@ -0,0 +1,389 @@
+#include "Memoizer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+
+CMemoizer::CMemoizer( size_t _capacity ) :
+	capacity( std::max( _capacity, static_cast<size_t>( 1 ) ) )
+{
+}
+
+// Classifications and cached results belong to one run of one image.
+void CMemoizer::Start( const CImage& code )
+{
+	functions.clear();
+	names.clear();
+	cache.clear();
+	order.clear();
+	pendingCalls.clear();
+	hitsCount = 0;
+	missesCount = 0;
+	evictionsCount = 0;
+	abandonedCount = 0;
+	for( const CImage::CSymbol& symbol : code.GetSymbols() ) {
+		if( symbol.Kind == CImage::FunctionSymbol ) {
+			names[symbol.Address] = symbol.Name;
+		}
+	}
+}
+
+bool CMemoizer::Call( CImage& code )
+{
+	const unsigned sp = code[1];
+	CFunction& function = getFunction( code[code[0] + 1], code );
+	++function.CallsCount;
+	if( function.State != Pure || sp < function.FrameSize || sp - function.FrameSize < resIndex + 1 ) {
+		return false;
+	}
+	const unsigned base = sp - function.FrameSize;
+	key.assign( 1, code[code[0] + 1] );
+	key.insert( key.end(), code.Data() + base, code.Data() + sp );
+
+	auto found = cache.find( key );
+	if( found == cache.end() ) {
+		++missesCount;
+		pendingCalls.push_back( CPendingCall{ key, base, function.ResultsCount, 0 } );
+		return false;
+	}
+	// The words the call would have popped are zero again, as pop leaves them.
+	const CEntry& entry = found->second;
+	const unsigned resultsEnd = base + static_cast<unsigned>( entry.Results.size() );
+	std::copy( entry.Results.begin(), entry.Results.end(), code.Data() + base );
+	if( resultsEnd < sp ) {
+		std::fill( code.Data() + resultsEnd, code.Data() + sp, 0 );
+	}
+	for( unsigned i = 0; i < registersCount; ++i ) {
+		if( ( entry.Written & ( 1u << i ) ) != 0 ) {
+			code[firstRegister + i] = entry.Registers[i];
+		}
+	}
+	if( !pendingCalls.empty() ) {
+		pendingCalls.back().Written |= entry.Written;
+	}
+	code[1] = resultsEnd;
+	code[0] = entry.ReturnAddress;
+	++hitsCount;
+	++function.HitsCount;
+	return true;
+}
+
+// Every return inside a pure call belongs to the innermost pending call, because a pure function calls only
+// pure ones. A return that does not leave the expected stack or go back to the caller stores nothing.
+void CMemoizer::Return( const CImage& code )
+{
+	if( pendingCalls.empty() ) {
+		return;
+	}
+	const CPendingCall& call = pendingCalls.back();
+	const unsigned returnWord = call.Key.back();
+	if( code[1] == call.Base + call.ResultsCount && code[resIndex] == returnWord && isInteger( returnWord ) ) {
+		store( call, code, returnWord - integerShift );
+	} else {
+		++abandonedCount;
+	}
+	const unsigned written = call.Written;
+	pendingCalls.pop_back();
+	if( !pendingCalls.empty() ) {
+		pendingCalls.back().Written |= written;
+	}
+}
+
+// Writes go to the innermost pending call and reach the outer ones when it returns.
+void CMemoizer::Step( unsigned address, unsigned command, const CImage& code )
+{
+	if( pendingCalls.empty() ) {
+		return;
+	}
+	switch( command ) {
+		case 1: // read
+		case 3: // pop
+		case 7: // equal
+		case 8: // add
+		case 9: // subtract
+			pendingCalls.back().Written |= 1u << ( resIndex - firstRegister );
+			break;
+		case 4: // move
+			if( address + 2 < code.Size() && isRegister( code[address + 2] ) ) {
+				pendingCalls.back().Written |= 1u << ( code[address + 2] - firstRegister );
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+unsigned long long CMemoizer::GetHitsCount() const
+{
+	return hitsCount;
+}
+
+unsigned long long CMemoizer::GetMissesCount() const
+{
+	return missesCount;
+}
+
+unsigned long long CMemoizer::GetEvictionsCount() const
+{
+	return evictionsCount;
+}
+
+void CMemoizer::WriteReport( std::ostream& stream ) const
+{
+	stream << "memoization: " << hitsCount << " hits, " << missesCount << " misses, " << cache.size() << " entries, "
+		<< evictionsCount << " evicted, " << abandonedCount << " abandoned" << std::endl;
+	std::map<std::string, const CFunction*> sorted;
+	for( const auto& function : functions ) {
+		sorted[getName( function.first )] = &function.second;
+	}
+	for( const auto& function : sorted ) {
+		stream << "  " << std::left << std::setw( 24 ) << function.first << std::right << std::setw( 12 )
+			<< function.second->CallsCount << " calls, " << function.second->HitsCount << " hits, ";
+		if( function.second->State == Pure ) {
+			stream << "pure, frame " << function.second->FrameSize << ", results " << function.second->ResultsCount;
+		} else {
+			stream << "not pure: " << function.second->Reason;
+		}
+		stream << std::endl;
+	}
+}
+
+CMemoizer::CFunction& CMemoizer::getFunction( unsigned slot, const CImage& code )
+{
+	auto found = functions.find( slot );
+	if( found != functions.end() ) {
+		return found->second;
+	}
+	CFunction& function = functions[slot];
+	function = CFunction{ InProgress, "", false, 0, 0, 0, 0 };
+	classify( slot, code, function );
+	return function;
+}
+
+// Calls of a function to itself need its frame and results before they are known: the first walk skips the
+// code after them, and later walks use what the previous one found until it does not change.
+void CMemoizer::classify( unsigned slot, const CImage& code, CFunction& function )
+{
+	for( unsigned i = 0; i < maxClassificationsCount; ++i ) {
+		const bool hadEffect = function.HasEffect;
+		const unsigned frameSize = function.FrameSize;
+		const unsigned resultsCount = function.ResultsCount;
+		bool isComplete = true;
+		if( !analyze( slot, code, function, isComplete ) ) {
+			function.State = Impure;
+			return;
+		}
+		if( isComplete && ( !hadEffect || ( frameSize == function.FrameSize && resultsCount == function.ResultsCount ) ) ) {
+			function.State = Pure;
+			return;
+		}
+	}
+	function.State = Impure;
+	function.Reason = "recursion does not settle";
+}
+
+// Walks every path from the entry keeping the stack depth relative to the entry and the registers written on
+// all paths so far. Depths must agree where paths meet and at every return.
+bool CMemoizer::analyze( unsigned slot, const CImage& code, CFunction& function, bool& isComplete )
+{
+	struct CPoint {
+		int Depth;
+		unsigned Written;
+	};
+
+	auto fail = [&function] ( const std::string& reason )
+	{
+		function.Reason = reason;
+		return false;
+	};
+
+	if( slot >= code.Size() ) {
+		return fail( "no entry" );
+	}
+	std::unordered_map<unsigned, CPoint> points;
+	std::vector<unsigned> worklist;
+	int minDepth = 0;
+	bool hasReturn = false;
+	int returnDepth = 0;
+
+	auto reach = [&points, &worklist] ( unsigned address, CPoint point )
+	{
+		auto found = points.find( address );
+		if( found == points.end() ) {
+			points[address] = point;
+			worklist.push_back( address );
+			return true;
+		}
+		if( found->second.Depth != point.Depth ) {
+			return false;
+		}
+		if( ( found->second.Written & point.Written ) != found->second.Written ) {
+			found->second.Written &= point.Written;
+			worklist.push_back( address );
+		}
+		return true;
+	};
+	reach( code[slot], CPoint{ 0, 0 } );
+
+	while( !worklist.empty() ) {
+		const unsigned address = worklist.back();
+		worklist.pop_back();
+		CPoint point = points[address];
+		if( address < resIndex + 1 || address + 2 >= code.Size() ) {
+			return fail( "runs out of the program" );
+		}
+		const unsigned command = code[address];
+		const unsigned argument1 = code[address + 1];
+		const unsigned argument2 = code[address + 2];
+		auto isReadable = [&point] ( unsigned word )
+		{
+			return isInteger( word ) || ( isRegister( word ) && ( point.Written & ( 1u << ( word - firstRegister ) ) ) != 0 );
+		};
+		auto write = [&point] ( unsigned reg )
+		{
+			point.Written |= 1u << ( reg - firstRegister );
+		};
+		bool proceeds = true;
+		switch( command ) {
+			case 0: // print
+			case 1: // read
+			case 13: // str
+				return fail( "input or output" );
+			case 12: // exit
+				return fail( "exits" );
+			case 2: // push
+				if( !isReadable( argument1 ) ) {
+					return fail( "reads a register it has not written" );
+				}
+				++point.Depth;
+				break;
+			case 3: // pop
+				minDepth = std::min( minDepth, --point.Depth );
+				write( resIndex );
+				break;
+			case 4: // move
+				if( !isReadable( argument1 ) ) {
+					return fail( "reads a register it has not written" );
+				}
+				if( !isRegister( argument2 ) ) {
+					return fail( "writes memory" );
+				}
+				write( argument2 );
+				break;
+			case 5: // if
+				if( !isReadable( argument1 ) ) {
+					return fail( "reads a register it has not written" );
+				}
+				if( argument2 >= code.Size() ) {
+					return fail( "jumps out of the program" );
+				}
+				if( !reach( code[argument2], point ) ) {
+					return fail( "stack depth differs where paths meet" );
+				}
+				break;
+			case 6: // call
+			{
+				unsigned frameSize = function.FrameSize;
+				unsigned resultsCount = function.ResultsCount;
+				if( argument1 == slot ) {
+					if( !function.HasEffect ) {
+						isComplete = false;
+						proceeds = false;
+						break;
+					}
+				} else {
+					const CFunction& callee = getFunction( argument1, code );
+					if( callee.State != Pure ) {
+						return fail( callee.State == InProgress ? "mutual recursion" : "calls " + getName( argument1 ) );
+					}
+					frameSize = callee.FrameSize;
+					resultsCount = callee.ResultsCount;
+				}
+				point.Depth -= static_cast<int>( frameSize );
+				minDepth = std::min( minDepth, point.Depth );
+				point.Depth += static_cast<int>( resultsCount );
+				break;
+			}
+			case 7: // equal
+			case 8: // add
+			case 9: // subtract
+				if( !isReadable( argument1 ) || !isReadable( argument2 ) ) {
+					return fail( "reads a register it has not written" );
+				}
+				write( resIndex );
+				break;
+			case 10: // pushaddr
+				++point.Depth;
+				break;
+			case 11: // return
+				if( !isReadable( resIndex ) || ( hasReturn && returnDepth != point.Depth ) ) {
+					return fail( "returns differently" );
+				}
+				hasReturn = true;
+				returnDepth = point.Depth;
+				proceeds = false;
+				break;
+			default:
+				return fail( "unknown command" );
+		}
+		if( proceeds && !reach( address + 3, point ) ) {
+			return fail( "stack depth differs where paths meet" );
+		}
+	}
+	if( !hasReturn ) {
+		return fail( "never returns" );
+	}
+	if( minDepth > -1 ) {
+		return fail( "keeps the return address" );
+	}
+	function.HasEffect = true;
+	function.FrameSize = static_cast<unsigned>( -minDepth );
+	function.ResultsCount = static_cast<unsigned>( returnDepth - minDepth );
+	return true;
+}
+
+void CMemoizer::store( const CPendingCall& call, const CImage& code, unsigned returnAddress )
+{
+	if( cache.find( call.Key ) != cache.end() ) {
+		return;
+	}
+	if( cache.size() >= capacity ) {
+		const std::vector<unsigned> oldest = *order.front();
+		order.pop_front();
+		cache.erase( oldest );
+		++evictionsCount;
+	}
+	auto inserted = cache.emplace( call.Key, CEntry() );
+	CEntry& entry = inserted.first->second;
+	entry.Results.assign( code.Data() + call.Base, code.Data() + call.Base + call.ResultsCount );
+	std::copy( code.Data() + firstRegister, code.Data() + firstRegister + registersCount, entry.Registers );
+	entry.Written = call.Written;
+	entry.ReturnAddress = returnAddress;
+	order.push_back( &inserted.first->first );
+}
+
+std::string CMemoizer::getName( unsigned slot ) const
+{
+	auto name = names.find( slot );
+	return name != names.end() ? name->second : "function" + std::to_string( slot );
+}
+
+// Size and words of the key are mixed in the way of boost::hash_combine.
+size_t CMemoizer::CKeyHash::operator()( const std::vector<unsigned>& key ) const
+{
+	size_t hash = key.size();
+	for( unsigned word : key ) {
+		hash ^= word + 0x9e3779b9 + ( hash << 6 ) + ( hash >> 2 );
+	}
+	return hash;
+}
+
+bool CMemoizer::isInteger( unsigned word )
+{
+	return word >= integerShift;
+}
+
+bool CMemoizer::isRegister( unsigned word )
+{
+	return word >= firstRegister && word <= resIndex;
+}
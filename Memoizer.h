@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Image.h"
+
+#include <cstddef>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Caches results of pure functions during a run. A function is classified the first time it is called by
+// walking its commands from the entry: it is pure if it does no input, output or exit, writes nothing but
+// registers and its stack, reads no register it has not written itself and calls only pure functions (or
+// itself). The walk also gives its frame, the words of the caller's stack it consumes, the return address
+// pushed by pushaddr included, and the number of words it leaves instead.
+//
+// A call of a pure function is looked up by the function and its frame. On a miss it runs as usual and its
+// return stores the result words and the registers; on a hit they are written back and the call returns at
+// once. Only the registers the recorded call actually wrote are restored, the caller's others are left alone,
+// as the path a pure function takes depends on nothing but its frame; the return address is part of the key,
+// so registers holding it are restored exactly.
+class CMemoizer {
+
+public:
+	explicit CMemoizer( size_t _capacity = 1 << 16 );
+
+	void Start( const CImage& code );
+	// Called before call and return run; Call returns true if the call was completed from the cache.
+	bool Call( CImage& code );
+	void Return( const CImage& code );
+	// Called before every command runs; records the register it writes for the pending calls.
+	void Step( unsigned address, unsigned command, const CImage& code );
+	unsigned long long GetHitsCount() const;
+	unsigned long long GetMissesCount() const;
+	unsigned long long GetEvictionsCount() const;
+	void WriteReport( std::ostream& stream ) const;
+
+private:
+	static const unsigned integerShift = 1 << 31;
+	static const unsigned firstRegister = 2;
+	static const unsigned resIndex = 9;
+	static const unsigned registersCount = resIndex - firstRegister + 1;
+	static const unsigned maxClassificationsCount = 4;
+
+	enum TState {
+		InProgress,
+		Pure,
+		Impure
+	};
+
+	struct CFunction {
+		TState State;
+		std::string Reason;
+		bool HasEffect;
+		unsigned FrameSize;
+		unsigned ResultsCount;
+		unsigned long long CallsCount;
+		unsigned long long HitsCount;
+	};
+
+	struct CEntry {
+		std::vector<unsigned> Results;
+		unsigned Registers[registersCount];
+		// Registers written by the recorded call and the calls it made.
+		unsigned Written;
+		unsigned ReturnAddress;
+	};
+
+	struct CPendingCall {
+		std::vector<unsigned> Key;
+		unsigned Base;
+		unsigned ResultsCount;
+		unsigned Written;
+	};
+
+	struct CKeyHash {
+		size_t operator()( const std::vector<unsigned>& key ) const;
+	};
+
+	size_t capacity;
+	std::unordered_map<unsigned, CFunction> functions;
+	std::unordered_map<unsigned, std::string> names;
+	std::unordered_map<std::vector<unsigned>, CEntry, CKeyHash> cache;
+	// Keys in the order of insertion; the oldest entry is evicted when the cache is full.
+	std::deque<const std::vector<unsigned>*> order;
+	std::vector<CPendingCall> pendingCalls;
+	std::vector<unsigned> key;
+	unsigned long long hitsCount = 0;
+	unsigned long long missesCount = 0;
+	unsigned long long evictionsCount = 0;
+	unsigned long long abandonedCount = 0;
+
+	CFunction& getFunction( unsigned slot, const CImage& code );
+	void classify( unsigned slot, const CImage& code, CFunction& function );
+	bool analyze( unsigned slot, const CImage& code, CFunction& function, bool& isComplete );
+	void store( const CPendingCall& call, const CImage& code, unsigned returnAddress );
+	std::string getName( unsigned slot ) const;
+	static bool isInteger( unsigned word );
+	static bool isRegister( unsigned word );
+};
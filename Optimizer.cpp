@@ -0,0 +1,336 @@
+#include "Optimizer.h"
+
+#include <algorithm>
+
+COptimizer::COptimizer()
+{
+}
+
+// Passes are repeated while they change something: a folded comparison may turn a branch into a jump, which
+// makes the code after it unreachable and the stores before it dead.
+void COptimizer::Optimize( std::vector<CIrCommand>& commands )
+{
+	markReturnPoints( commands );
+	for( unsigned pass = 0; pass < maxPassesCount; ++pass ) {
+		bool changed = propagate( commands );
+		changed = removeUnreachable( commands ) || changed;
+		changed = removeDeadStores( commands ) || changed;
+		if( !changed ) {
+			break;
+		}
+	}
+}
+
+unsigned COptimizer::GetRemovedCount() const
+{
+	return removedCount;
+}
+
+unsigned COptimizer::GetFoldedCount() const
+{
+	return foldedCount;
+}
+
+// pushaddr pushes the address of the command two commands after it, so the command between them must stay
+// and the one returned to is reached with unknown registers.
+void COptimizer::markReturnPoints( std::vector<CIrCommand>& commands )
+{
+	std::vector<CIrCommand*> executable;
+	for( CIrCommand& command : commands ) {
+		if( command.Command != Label ) {
+			executable.push_back( &command );
+		}
+	}
+	for( size_t i = 0; i < executable.size(); ++i ) {
+		if( executable[i]->Command != Pushaddr ) {
+			continue;
+		}
+		if( i + 1 < executable.size() ) {
+			executable[i + 1]->IsPinned = true;
+		}
+		if( i + 2 < executable.size() ) {
+			executable[i + 2]->IsEntry = true;
+		}
+	}
+}
+
+// Replaces registers of known value with immediates or with the registers they were copied from, folds
+// arithmetic on immediates, drops moves that do not change anything and branches that are never taken,
+// and turns push followed by pop into a move to res. A branch to the label right after it goes nowhere either way.
+bool COptimizer::propagate( std::vector<CIrCommand>& commands )
+{
+	bool changed = false;
+	forget();
+	for( size_t i = 0; i < commands.size(); ++i ) {
+		CIrCommand& command = commands[i];
+		if( command.Command == Removed ) {
+			continue;
+		}
+		if( command.IsEntry ) {
+			forget();
+		}
+		const unsigned operandsCount = getOperandsCount( command.Command );
+		if( operandsCount > 0 && resolve( command.Argument1 ) != command.Argument1 ) {
+			command.Argument1 = resolve( command.Argument1 );
+			changed = true;
+		}
+		if( operandsCount > 1 && resolve( command.Argument2 ) != command.Argument2 ) {
+			command.Argument2 = resolve( command.Argument2 );
+			changed = true;
+		}
+		switch( command.Command ) {
+			case Label:
+			case Call:
+				forget();
+				break;
+			case Read:
+			case Pop:
+				assign( resIndex, CValue{ Unknown, 0 } );
+				break;
+			case Push:
+				if( i + 1 < commands.size() && commands[i + 1].Command == Pop && !command.IsPinned
+					&& !commands[i + 1].IsPinned && !commands[i + 1].IsEntry )
+				{
+					command = CIrCommand{ Move, command.Argument1, resIndex, false, command.IsEntry };
+					remove( commands[i + 1] );
+					propagateMove( command );
+					changed = true;
+				}
+				break;
+			case Move:
+				changed = propagateMove( command ) || changed;
+				break;
+			case If:
+				if( ( command.Argument1 == integerShift || isJumpToNext( commands, i ) ) && !command.IsPinned ) {
+					remove( command );
+					changed = true;
+				}
+				break;
+			case Equal:
+			case Add:
+			case Subtract:
+				if( fold( command ) ) {
+					propagateMove( command );
+					changed = true;
+				} else {
+					assign( resIndex, CValue{ Unknown, 0 } );
+				}
+				break;
+		}
+	}
+	return compact( commands ) > 0 || changed;
+}
+
+bool COptimizer::isJumpToNext( const std::vector<CIrCommand>& commands, size_t index )
+{
+	for( size_t i = index + 1; i < commands.size() && commands[i].Command == Label; ++i ) {
+		if( commands[i].Argument1 == commands[index].Argument2 ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns true if the move is removed because the register already holds the value.
+bool COptimizer::propagateMove( CIrCommand& command )
+{
+	const unsigned reg = command.Argument2;
+	if( !isRegister( reg ) ) {
+		forget();
+		return false;
+	}
+	CValue value{ Unknown, 0 };
+	if( isInteger( command.Argument1 ) ) {
+		value = CValue{ Constant, command.Argument1 - integerShift };
+	} else if( isRegister( command.Argument1 ) ) {
+		value = CValue{ Copy, command.Argument1 };
+	}
+	const CValue& current = values[reg - firstRegister];
+	const bool isSame = ( value.Kind == Copy && value.Value == reg )
+		|| ( value.Kind != Unknown && current.Kind == value.Kind && current.Value == value.Value );
+	if( isSame && !command.IsPinned ) {
+		remove( command );
+		return true;
+	}
+	if( !isSame ) {
+		assign( reg, value );
+	}
+	return false;
+}
+
+// Subtraction of a larger number and additions leaving the range of immediates are left to fail or wrap
+// at runtime as they always did.
+bool COptimizer::fold( CIrCommand& command )
+{
+	if( !isInteger( command.Argument1 ) || !isInteger( command.Argument2 ) ) {
+		return false;
+	}
+	const unsigned long long left = command.Argument1 - integerShift;
+	const unsigned long long right = command.Argument2 - integerShift;
+	unsigned long long result = 0;
+	switch( command.Command ) {
+		case Equal:
+			result = left == right ? 1 : 0;
+			break;
+		case Add:
+			result = left + right;
+			break;
+		case Subtract:
+			if( left < right ) {
+				return false;
+			}
+			result = left - right;
+			break;
+	}
+	if( result >= integerShift ) {
+		return false;
+	}
+	command = CIrCommand{ Move, static_cast<unsigned>( result ) + integerShift, resIndex, command.IsPinned,
+		command.IsEntry };
+	++foldedCount;
+	return true;
+}
+
+unsigned COptimizer::resolve( unsigned word ) const
+{
+	if( !isRegister( word ) ) {
+		return word;
+	}
+	const CValue& value = values[word - firstRegister];
+	if( value.Kind == Constant ) {
+		return value.Value + integerShift;
+	}
+	return value.Kind == Copy ? value.Value : word;
+}
+
+// Registers copied from the assigned one keep its old value and are no longer known to be equal to it.
+void COptimizer::assign( unsigned reg, CValue value )
+{
+	for( CValue& other : values ) {
+		if( other.Kind == Copy && other.Value == reg ) {
+			other = CValue{ Unknown, 0 };
+		}
+	}
+	values[reg - firstRegister] = value;
+}
+
+void COptimizer::forget()
+{
+	std::fill( values, values + registersCount, CValue{ Unknown, 0 } );
+}
+
+// Code after exit, return or a branch that is always taken is only reached through a label or a return point.
+bool COptimizer::removeUnreachable( std::vector<CIrCommand>& commands )
+{
+	bool isReachable = true;
+	for( CIrCommand& command : commands ) {
+		if( command.Command == Label || command.IsEntry ) {
+			isReachable = true;
+		}
+		if( !isReachable ) {
+			remove( command );
+			continue;
+		}
+		if( command.Command == Exit || command.Command == Return
+			|| ( command.Command == If && isInteger( command.Argument1 ) && command.Argument1 != integerShift ) )
+		{
+			isReachable = false;
+		}
+	}
+	return compact( commands ) > 0;
+}
+
+// Walks the commands backwards keeping the registers that may be read later. Everything is alive where control
+// may leave the straight line, nothing is after exit. Moves and results of equal and add that nobody reads
+// are removed; subtract may fail and read and pop have side effects, so they stay.
+bool COptimizer::removeDeadStores( std::vector<CIrCommand>& commands )
+{
+	bool isAlive[registersCount];
+	std::fill( isAlive, isAlive + registersCount, true );
+	for( size_t i = commands.size(); i-- > 0; ) {
+		CIrCommand& command = commands[i];
+		switch( command.Command ) {
+			case Exit:
+				std::fill( isAlive, isAlive + registersCount, false );
+				break;
+			case If:
+			case Call:
+			case Return:
+				std::fill( isAlive, isAlive + registersCount, true );
+				break;
+			case Move:
+			case Equal:
+			case Add:
+			{
+				const unsigned reg = command.Command == Move ? command.Argument2 : resIndex;
+				if( !isRegister( reg ) ) {
+					std::fill( isAlive, isAlive + registersCount, true );
+					break;
+				}
+				if( !isAlive[reg - firstRegister] && !command.IsPinned ) {
+					remove( command );
+					continue;
+				}
+				isAlive[reg - firstRegister] = false;
+				break;
+			}
+			case Subtract:
+			case Read:
+			case Pop:
+				isAlive[resIndex - firstRegister] = false;
+				break;
+		}
+		const unsigned operandsCount = getOperandsCount( command.Command );
+		if( operandsCount > 0 && isRegister( command.Argument1 ) ) {
+			isAlive[command.Argument1 - firstRegister] = true;
+		}
+		if( operandsCount > 1 && isRegister( command.Argument2 ) ) {
+			isAlive[command.Argument2 - firstRegister] = true;
+		}
+	}
+	return compact( commands ) > 0;
+}
+
+void COptimizer::remove( CIrCommand& command )
+{
+	command.Command = Removed;
+}
+
+unsigned COptimizer::compact( std::vector<CIrCommand>& commands )
+{
+	const size_t size = commands.size();
+	commands.erase( std::remove_if( commands.begin(), commands.end(),
+		[] ( const CIrCommand& command )
+	{
+		return command.Command == Removed;
+	} ), commands.end() );
+	removedCount += static_cast<unsigned>( size - commands.size() );
+	return static_cast<unsigned>( size - commands.size() );
+}
+
+bool COptimizer::isInteger( unsigned word )
+{
+	return word >= integerShift;
+}
+
+bool COptimizer::isRegister( unsigned word )
+{
+	return word >= firstRegister && word <= resIndex;
+}
+
+// Operands read as values; the second word of move, if and call is a destination.
+unsigned COptimizer::getOperandsCount( unsigned command )
+{
+	switch( command ) {
+		case Print:
+		case Push:
+		case Move:
+		case If:
+			return 1;
+		case Equal:
+		case Add:
+		case Subtract:
+			return 2;
+	}
+	return 0;
+}
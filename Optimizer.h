@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Command of the intermediate representation: the three words of an assembled command, or a definition of
+// the label whose slot is Argument1.
+struct CIrCommand {
+	unsigned Command;
+	unsigned Argument1;
+	unsigned Argument2;
+	// The command right after pushaddr: removing it would move the return address.
+	bool IsPinned;
+	// The command pushaddr returns to; like a label it may be reached from elsewhere.
+	bool IsEntry;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+// Optimizes the commands of one function. Registers are followed through straight-line code only: labels,
+// return points and calls forget everything known about them, jumps and returns keep all of them alive.
+// Commands are removed or rewritten in place and never added, so a command keeps its three words.
+class COptimizer {
+
+public:
+	enum TCommand {
+		Print,
+		Read,
+		Push,
+		Pop,
+		Move,
+		If,
+		Call,
+		Equal,
+		Add,
+		Subtract,
+		Pushaddr,
+		Return,
+		Exit,
+		Str,
+		Label,
+		Removed
+	};
+
+	COptimizer();
+
+	void Optimize( std::vector<CIrCommand>& commands );
+	unsigned GetRemovedCount() const;
+	unsigned GetFoldedCount() const;
+
+private:
+	static const unsigned integerShift = 1 << 31;
+	static const unsigned firstRegister = 2;
+	static const unsigned resIndex = 9;
+	static const unsigned registersCount = 8;
+	static const unsigned maxPassesCount = 8;
+
+	enum TValue {
+		Unknown,
+		Constant,
+		Copy
+	};
+
+	// What a register is known to hold: an immediate, or the same value as another register.
+	struct CValue {
+		TValue Kind;
+		unsigned Value;
+	};
+
+	unsigned removedCount = 0;
+	unsigned foldedCount = 0;
+	CValue values[registersCount];
+
+	static void markReturnPoints( std::vector<CIrCommand>& commands );
+	bool propagate( std::vector<CIrCommand>& commands );
+	static bool isJumpToNext( const std::vector<CIrCommand>& commands, size_t index );
+	bool propagateMove( CIrCommand& command );
+	bool fold( CIrCommand& command );
+	unsigned resolve( unsigned word ) const;
+	void assign( unsigned reg, CValue value );
+	void forget();
+	bool removeUnreachable( std::vector<CIrCommand>& commands );
+	bool removeDeadStores( std::vector<CIrCommand>& commands );
+	void remove( CIrCommand& command );
+	unsigned compact( std::vector<CIrCommand>& commands );
+	static bool isInteger( unsigned word );
+	static bool isRegister( unsigned word );
+	static unsigned getOperandsCount( unsigned command );
+};
@@ -0,0 +1,145 @@
+#include "Output.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined( _WIN32 )
+#include <io.h>
+#elif defined( __unix__ ) || defined( __APPLE__ )
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char digitPairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+} // namespace
+
+COutput::COutput( std::ostream& _stream, TFlushPolicy policy, unsigned capacity ) :
+	stream( &_stream ),
+	buffer( capacity < maxNumberLength + 1 ? maxNumberLength + 1 : capacity )
+{
+	Reset( _stream, policy );
+}
+
+// The old stream is not touched, as it may be gone already; every run flushes at its end, so what is left in
+// the buffer is dropped.
+void COutput::Reset( std::ostream& _stream, TFlushPolicy policy )
+{
+	size = 0;
+	stream = &_stream;
+	if( policy == TFlushPolicy::Auto ) {
+		policy = isTerminal( _stream ) ? TFlushPolicy::Line : TFlushPolicy::Read;
+	}
+	flushOnRead = policy == TFlushPolicy::Read || policy == TFlushPolicy::Line;
+	flushOnLine = policy == TFlushPolicy::Line;
+}
+
+// Digits are produced two at a time from the end of a small scratch buffer.
+void COutput::WriteNumber( unsigned value )
+{
+	char digits[maxNumberLength];
+	char* end = digits + maxNumberLength;
+	char* begin = end;
+	while( value >= 100 ) {
+		const char* pair = digitPairs + 2 * ( value % 100 );
+		value /= 100;
+		*--begin = pair[1];
+		*--begin = pair[0];
+	}
+	if( value >= 10 ) {
+		const char* pair = digitPairs + 2 * value;
+		*--begin = pair[1];
+		*--begin = pair[0];
+	} else {
+		*--begin = static_cast<char>( '0' + value );
+	}
+	reserve( static_cast<unsigned>( end - begin ) );
+	std::memcpy( buffer.data() + size, begin, end - begin );
+	size += static_cast<unsigned>( end - begin );
+}
+
+// Writes the zero-terminated string packed into words, the first character in the highest byte.
+// Words without a zero byte are copied whole; the string also ends with the last available word.
+void COutput::WriteString( const unsigned* words, unsigned count )
+{
+	for( unsigned i = 0; i < count; ++i ) {
+		const unsigned word = words[i];
+		reserve( 4 );
+		char* target = buffer.data() + size;
+		if( !hasZeroByte( word ) ) {
+			target[0] = static_cast<char>( word >> 24 );
+			target[1] = static_cast<char>( word >> 16 );
+			target[2] = static_cast<char>( word >> 8 );
+			target[3] = static_cast<char>( word );
+			size += 4;
+			continue;
+		}
+		for( int j = 24; j >= 0; j -= 8 ) {
+			const char c = static_cast<char>( ( word >> j ) & 0xFF );
+			if( c == 0 ) {
+				return;
+			}
+			buffer[size++] = c;
+		}
+	}
+}
+
+void COutput::EndLine()
+{
+	reserve( 1 );
+	buffer[size++] = '\n';
+	if( flushOnLine ) {
+		Flush();
+	}
+}
+
+void COutput::BeforeRead()
+{
+	if( flushOnRead ) {
+		Flush();
+	}
+}
+
+void COutput::Flush()
+{
+	if( size != 0 ) {
+		stream->write( buffer.data(), size );
+		size = 0;
+	}
+	stream->flush();
+}
+
+void COutput::reserve( unsigned count )
+{
+	if( size + count > buffer.size() ) {
+		stream->write( buffer.data(), size );
+		size = 0;
+	}
+}
+
+bool COutput::hasZeroByte( unsigned word )
+{
+	return ( ( word - 0x01010101u ) & ~word & 0x80808080u ) != 0;
+}
+
+bool COutput::isTerminal( const std::ostream& stream )
+{
+#if defined( _WIN32 )
+	return &stream == &std::cout && _isatty( _fileno( stdout ) ) != 0;
+#elif defined( __unix__ ) || defined( __APPLE__ )
+	return &stream == &std::cout && isatty( fileno( stdout ) ) != 0;
+#else
+	return &stream == &std::cout;
+#endif
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+
+// Buffered output of the virtual machine. Numbers are formatted by hand and strings are copied from the packed
+// big-endian words of the image four characters at a time; the stream only sees large writes.
+class COutput {
+
+public:
+	enum class TFlushPolicy {
+		// Flush when the buffer is full and when the program ends.
+		Exit,
+		// Also flush before every read, so that prompts are visible.
+		Read,
+		// Also flush after every line.
+		Line,
+		// Line for terminals, Read for everything else.
+		Auto
+	};
+
+	explicit COutput( std::ostream& _stream = std::cout, TFlushPolicy policy = TFlushPolicy::Auto,
+		unsigned capacity = defaultCapacity );
+
+	void Reset( std::ostream& _stream, TFlushPolicy policy );
+	void WriteNumber( unsigned value );
+	void WriteString( const unsigned* words, unsigned count );
+	void EndLine();
+	void BeforeRead();
+	void Flush();
+
+private:
+	static const unsigned defaultCapacity = 1 << 16;
+	static const unsigned maxNumberLength = 10;
+	std::ostream* stream;
+	bool flushOnRead = false;
+	bool flushOnLine = false;
+	std::vector<char> buffer;
+	unsigned size = 0;
+
+	void reserve( unsigned count );
+	static bool hasZeroByte( unsigned word );
+	static bool isTerminal( const std::ostream& stream );
+};
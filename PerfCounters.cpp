@@ -0,0 +1,246 @@
+#include "PerfCounters.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+
+#if defined( __linux__ )
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define VM_HAS_PERF_EVENTS
+#endif
+
+namespace {
+
+const char* const eventNames[] = {
+	"cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses", "task-clock-ns",
+};
+
+} // namespace
+
+CPerfCounters::CPerfCounters( bool _isPerCommand ) :
+	isPerCommand( _isPerCommand )
+{
+	std::fill( descriptors, descriptors + EventsCount, -1 );
+	std::fill( positions, positions + EventsCount, 0 );
+	open();
+	if( isPerCommand && IsAvailable() ) {
+		calibrate();
+	}
+}
+
+CPerfCounters::~CPerfCounters()
+{
+#ifdef VM_HAS_PERF_EVENTS
+	for( int descriptor : descriptors ) {
+		if( descriptor >= 0 ) {
+			close( descriptor );
+		}
+	}
+#endif
+}
+
+bool CPerfCounters::IsAvailable() const
+{
+	return leader >= 0;
+}
+
+bool CPerfCounters::IsAvailable( TEvent event ) const
+{
+	return descriptors[event] >= 0;
+}
+
+bool CPerfCounters::IsPerCommand() const
+{
+	return isPerCommand && IsAvailable();
+}
+
+void CPerfCounters::Start()
+{
+	std::fill( totals, totals + EventsCount, 0 );
+	std::fill( &commandValues[0][0], &commandValues[0][0] + commandsCount * EventsCount, 0 );
+	std::fill( commandCounts, commandCounts + commandsCount, 0 );
+	lastCommand = noCommand;
+	executedCount = 0;
+	if( !IsAvailable() ) {
+		return;
+	}
+#ifdef VM_HAS_PERF_EVENTS
+	ioctl( leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+	ioctl( leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+#endif
+	read( last );
+}
+
+// The values read now were spent by the previous command and by the dispatch that led to this one.
+void CPerfCounters::Count( unsigned command )
+{
+	unsigned long long values[EventsCount] = {};
+	read( values );
+	attribute( values );
+	lastCommand = command;
+}
+
+// Totals cover the whole run, including the cost of the per-command reads when they are made.
+void CPerfCounters::Stop( unsigned long long _executedCount )
+{
+	executedCount = _executedCount;
+	if( !IsAvailable() ) {
+		return;
+	}
+	unsigned long long values[EventsCount] = {};
+	read( values );
+#ifdef VM_HAS_PERF_EVENTS
+	ioctl( leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+#endif
+	if( isPerCommand ) {
+		attribute( values );
+	}
+	std::copy( values, values + EventsCount, totals );
+}
+
+unsigned long long CPerfCounters::GetValue( TEvent event ) const
+{
+	return totals[event];
+}
+
+void CPerfCounters::WriteReport( std::ostream& stream ) const
+{
+	if( !IsAvailable() ) {
+		stream << "counters: not available" << std::endl;
+		return;
+	}
+	stream << "counters: " << executedCount << " VM instructions" << std::endl;
+	for( unsigned i = 0; i < EventsCount; ++i ) {
+		stream << "  " << std::left << std::setw( 16 ) << eventNames[i] << std::right;
+		if( IsAvailable( static_cast<TEvent>( i ) ) ) {
+			stream << std::setw( 16 ) << totals[i] << std::setw( 12 ) << std::fixed << std::setprecision( 3 )
+				<< static_cast<double>( totals[i] ) / std::max( executedCount, 1ull ) << " per VM instruction"
+				<< std::defaultfloat << std::endl;
+		} else {
+			stream << std::setw( 16 ) << "unavailable" << std::endl;
+		}
+	}
+	if( IsAvailable( Cycles ) && IsAvailable( Instructions ) ) {
+		stream << "  IPC " << std::fixed << std::setprecision( 3 )
+			<< static_cast<double>( totals[Instructions] ) / std::max( totals[Cycles], 1ull ) << std::defaultfloat
+			<< std::endl;
+	}
+	if( !IsPerCommand() ) {
+		return;
+	}
+	stream << "per command:" << std::endl;
+	for( unsigned command = 0; command < commandsCount; ++command ) {
+		if( commandCounts[command] == 0 ) {
+			continue;
+		}
+		stream << "  " << std::left << std::setw( 10 ) << CProfiler::GetCommandName( command ) << std::right
+			<< std::setw( 14 ) << commandCounts[command];
+		for( unsigned i = 0; i < EventsCount; ++i ) {
+			if( IsAvailable( static_cast<TEvent>( i ) ) ) {
+				stream << "  " << eventNames[i] << " " << std::fixed << std::setprecision( 2 )
+					<< static_cast<double>( commandValues[command][i] ) / commandCounts[command] << std::defaultfloat;
+			}
+		}
+		stream << std::endl;
+	}
+}
+
+std::string CPerfCounters::GetEventName( TEvent event )
+{
+	return eventNames[event];
+}
+
+// All events are opened in one group so that they are enabled, disabled and read together. The first event
+// that opens becomes the group leader; events that fail to open are left out.
+void CPerfCounters::open()
+{
+#ifdef VM_HAS_PERF_EVENTS
+	const struct {
+		unsigned Type;
+		unsigned long long Config;
+	} events[EventsCount] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | ( PERF_COUNT_HW_CACHE_OP_READ << 8 )
+			| ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+	};
+	for( unsigned i = 0; i < EventsCount; ++i ) {
+		perf_event_attr attributes;
+		std::memset( &attributes, 0, sizeof( attributes ) );
+		attributes.size = sizeof( attributes );
+		attributes.type = events[i].Type;
+		attributes.config = events[i].Config;
+		attributes.disabled = leader < 0 ? 1 : 0;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+		attributes.read_format = PERF_FORMAT_GROUP;
+		int descriptor = static_cast<int>( syscall( SYS_perf_event_open, &attributes, 0, -1, leader, 0 ) );
+		if( descriptor < 0 ) {
+			continue;
+		}
+		descriptors[i] = descriptor;
+		positions[i] = openCount++;
+		if( leader < 0 ) {
+			leader = descriptor;
+		}
+	}
+#endif
+}
+
+void CPerfCounters::read( unsigned long long* values ) const
+{
+#ifdef VM_HAS_PERF_EVENTS
+	unsigned long long buffer[EventsCount + 1] = {};
+	if( ::read( leader, buffer, sizeof( buffer ) ) <= 0 ) {
+		return;
+	}
+	for( unsigned i = 0; i < EventsCount; ++i ) {
+		if( descriptors[i] >= 0 && positions[i] < buffer[0] ) {
+			values[i] = buffer[1 + positions[i]];
+		}
+	}
+#else
+	static_cast<void>( values );
+#endif
+}
+
+// Finds the smallest difference between two reads in a row, the part of every per-command difference that
+// belongs to the measurement itself.
+void CPerfCounters::calibrate()
+{
+#ifdef VM_HAS_PERF_EVENTS
+	ioctl( leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+	ioctl( leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+	std::fill( readCost, readCost + EventsCount, ~0ull );
+	unsigned long long previous[EventsCount] = {};
+	read( previous );
+	for( unsigned i = 0; i < calibrationReads; ++i ) {
+		unsigned long long values[EventsCount] = {};
+		read( values );
+		for( unsigned j = 0; j < EventsCount; ++j ) {
+			readCost[j] = std::min( readCost[j], values[j] - previous[j] );
+		}
+		std::copy( values, values + EventsCount, previous );
+	}
+	ioctl( leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+#endif
+}
+
+void CPerfCounters::attribute( const unsigned long long* values )
+{
+	if( lastCommand != noCommand ) {
+		++commandCounts[lastCommand];
+		for( unsigned i = 0; i < EventsCount; ++i ) {
+			unsigned long long difference = values[i] - last[i];
+			commandValues[lastCommand][i] += difference > readCost[i] ? difference - readCost[i] : 0;
+		}
+	}
+	std::copy( values, values + EventsCount, last );
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Hardware performance counters of the calling thread, read through perf_event_open on Linux. Events the CPU
+// or the kernel does not provide are reported as unavailable; on other platforms none are.
+//
+// In the per-command mode the virtual machine reads the counters before every instruction and the difference
+// is attributed to the previous one. Each read is a system call, so this mode slows the run down a lot; the
+// cost of a read measured with nothing in between is subtracted from every attributed difference.
+class CPerfCounters {
+
+public:
+	enum TEvent {
+		Cycles,
+		Instructions,
+		BranchMisses,
+		L1DataMisses,
+		LastLevelMisses,
+		TaskClock,
+		EventsCount
+	};
+
+	explicit CPerfCounters( bool _isPerCommand = false );
+	CPerfCounters( const CPerfCounters& ) = delete;
+	CPerfCounters& operator=( const CPerfCounters& ) = delete;
+	~CPerfCounters();
+
+	bool IsAvailable() const;
+	bool IsAvailable( TEvent event ) const;
+	bool IsPerCommand() const;
+	void Start();
+	void Count( unsigned command );
+	void Stop( unsigned long long _executedCount );
+	unsigned long long GetValue( TEvent event ) const;
+	void WriteReport( std::ostream& stream ) const;
+	static std::string GetEventName( TEvent event );
+
+private:
+	static const unsigned commandsCount = 14;
+	static const unsigned noCommand = ~0u;
+	static const unsigned calibrationReads = 64;
+
+	bool isPerCommand;
+	int leader = -1;
+	int descriptors[EventsCount];
+	// Position of each open event in the values of a group read.
+	unsigned positions[EventsCount];
+	unsigned openCount = 0;
+	unsigned long long totals[EventsCount] = {};
+	unsigned long long executedCount = 0;
+	unsigned long long readCost[EventsCount] = {};
+	unsigned long long commandValues[commandsCount][EventsCount] = {};
+	unsigned long long commandCounts[commandsCount] = {};
+	unsigned long long last[EventsCount] = {};
+	unsigned lastCommand = noCommand;
+
+	void open();
+	void read( unsigned long long* values ) const;
+	void calibrate();
+	void attribute( const unsigned long long* values );
+};
@@ -0,0 +1,114 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+
+const char* const commandNames[] = {
+	"print", "read", "push", "pop", "move", "if", "call",
+	"equal", "add", "subtract", "pushaddr", "return", "exit", "str",
+};
+
+} // namespace
+
+CProfiler::CProfiler()
+{
+}
+
+void CProfiler::Start( unsigned memorySize )
+{
+	totalCount = 0;
+	std::fill( commandCounts, commandCounts + commandsCount, 0 );
+	addressCounts.assign( memorySize, 0 );
+	addressCommands.assign( memorySize, 0 );
+}
+
+void CProfiler::Count( unsigned address, unsigned command )
+{
+	++totalCount;
+	++commandCounts[command];
+	++addressCounts[address];
+	addressCommands[address] = static_cast<unsigned char>( command );
+}
+
+unsigned long long CProfiler::GetTotalCount() const
+{
+	return totalCount;
+}
+
+unsigned long long CProfiler::GetCommandCount( unsigned command ) const
+{
+	return command < commandsCount ? commandCounts[command] : 0;
+}
+
+unsigned long long CProfiler::GetAddressCount( unsigned address ) const
+{
+	return address < addressCounts.size() ? addressCounts[address] : 0;
+}
+
+// Commands and addresses are listed from the most executed one; addresses that never ran are skipped.
+void CProfiler::WriteReport( std::ostream& stream, unsigned hotSpotsCount ) const
+{
+	stream << "profile: " << totalCount << " instructions" << std::endl;
+	std::vector<unsigned> commands;
+	for( unsigned i = 0; i < commandsCount; ++i ) {
+		if( commandCounts[i] != 0 ) {
+			commands.push_back( i );
+		}
+	}
+	std::stable_sort( commands.begin(), commands.end(),
+		[this] ( unsigned left, unsigned right )
+	{
+		return commandCounts[left] > commandCounts[right];
+	} );
+	stream << "commands:" << std::endl;
+	for( unsigned command : commands ) {
+		writeLine( stream, commandNames[command], commandCounts[command] );
+	}
+
+	std::vector<unsigned> addresses;
+	for( unsigned i = 0; i < addressCounts.size(); ++i ) {
+		if( addressCounts[i] != 0 ) {
+			addresses.push_back( i );
+		}
+	}
+	std::stable_sort( addresses.begin(), addresses.end(),
+		[this] ( unsigned left, unsigned right )
+	{
+		return addressCounts[left] > addressCounts[right];
+	} );
+	stream << "hot spots:" << std::endl;
+	for( unsigned i = 0; i < addresses.size() && i < hotSpotsCount; ++i ) {
+		const unsigned address = addresses[i];
+		writeLine( stream, std::to_string( address ) + " " + commandNames[addressCommands[address]],
+			addressCounts[address] );
+	}
+}
+
+// One record per line in a fixed order, so that dumps of two builds can be compared with diff.
+void CProfiler::WriteDump( std::ostream& stream ) const
+{
+	stream << "total " << totalCount << "\n";
+	for( unsigned i = 0; i < commandsCount; ++i ) {
+		stream << "command " << commandNames[i] << " " << commandCounts[i] << "\n";
+	}
+	for( unsigned i = 0; i < addressCounts.size(); ++i ) {
+		if( addressCounts[i] != 0 ) {
+			stream << "address " << i << " " << commandNames[addressCommands[i]] << " " << addressCounts[i] << "\n";
+		}
+	}
+	stream.flush();
+}
+
+std::string CProfiler::GetCommandName( unsigned command )
+{
+	return command < commandsCount ? commandNames[command] : "unknown";
+}
+
+void CProfiler::writeLine( std::ostream& stream, const std::string& name, unsigned long long count ) const
+{
+	stream << "  " << std::left << std::setw( 16 ) << name << std::right << std::setw( 14 ) << count << "  "
+		<< std::fixed << std::setprecision( 2 ) << std::setw( 6 ) << 100.0 * count / std::max( totalCount, 1ull )
+		<< "%" << std::defaultfloat << std::endl;
+}
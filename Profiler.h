@@ -0,0 +1,33 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Execution counts of a profiled run, per command and per address of the memory image. The virtual machine
+// fills them through Start and Count when a profiler is attached; runs without one do not pay for it.
+class CProfiler {
+
+public:
+	CProfiler();
+
+	void Start( unsigned memorySize );
+	void Count( unsigned address, unsigned command );
+	unsigned long long GetTotalCount() const;
+	unsigned long long GetCommandCount( unsigned command ) const;
+	unsigned long long GetAddressCount( unsigned address ) const;
+	void WriteReport( std::ostream& stream, unsigned hotSpotsCount = defaultHotSpotsCount ) const;
+	void WriteDump( std::ostream& stream ) const;
+	static std::string GetCommandName( unsigned command );
+
+private:
+	static const unsigned commandsCount = 14;
+	static const unsigned defaultHotSpotsCount = 20;
+	unsigned long long totalCount = 0;
+	unsigned long long commandCounts[commandsCount] = {};
+	std::vector<unsigned long long> addressCounts;
+	// Command last executed at each address; self-modifying programs may run several at one address.
+	std::vector<unsigned char> addressCommands;
+
+	void writeLine( std::ostream& stream, const std::string& name, unsigned long long count ) const;
+};
@@ -0,0 +1,160 @@
+#include "Exception.h"
+#include "Scheduler.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+CScheduler::CScheduler( unsigned _threadsCount, unsigned long long _quantum, CVirtualMachine::TCore _core ) :
+	threadsCount( _threadsCount ),
+	quantum( _quantum ),
+	core( _core )
+{
+	if( threadsCount == 0 ) {
+		threadsCount = std::thread::hardware_concurrency();
+	}
+	if( threadsCount == 0 ) {
+		threadsCount = 1;
+	}
+	if( quantum == 0 ) {
+		throw CInvalidArguments( "CScheduler::CScheduler::InvalidArguments - Quantum must be positive." );
+	}
+}
+
+unsigned CScheduler::Add( const std::string& pathToBinaryFile, const std::string& input, bool isInputClosed )
+{
+	std::lock_guard<std::mutex> lock( mutex );
+	std::unique_ptr<CTask> task( new CTask );
+	task->PathToBinaryFile = pathToBinaryFile;
+	task->Pending = input;
+	task->IsPendingClosed = isInputClosed;
+	tasks.push_back( std::move( task ) );
+	ready.push_back( static_cast<unsigned>( tasks.size() - 1 ) );
+	return static_cast<unsigned>( tasks.size() - 1 );
+}
+
+// A task waiting for input goes back to the queue; a running one takes the data with its next slice.
+void CScheduler::Feed( unsigned task, const std::string& data, bool isLast )
+{
+	std::lock_guard<std::mutex> lock( mutex );
+	if( task >= tasks.size() ) {
+		throw CInvalidArguments( "CScheduler::Feed::InvalidArguments - Unknown task." );
+	}
+	CTask& fed = *tasks[task];
+	fed.Pending += data;
+	fed.IsPendingClosed = fed.IsPendingClosed || isLast;
+	if( fed.IsWaiting ) {
+		fed.IsWaiting = false;
+		ready.push_back( task );
+		changed.notify_one();
+	}
+}
+
+void CScheduler::Run()
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for( unsigned i = 1; i < threadsCount; ++i ) {
+		threads.emplace_back( &CScheduler::work, this );
+	}
+	work();
+	for( std::thread& thread : threads ) {
+		thread.join();
+	}
+	auto finish = std::chrono::steady_clock::now();
+	wallTime = std::chrono::duration<double>( finish - start ).count();
+}
+
+const CScheduledResult& CScheduler::GetResult( unsigned task ) const
+{
+	if( task >= tasks.size() ) {
+		throw CInvalidArguments( "CScheduler::GetResult::InvalidArguments - Unknown task." );
+	}
+	return tasks[task]->Result;
+}
+
+unsigned CScheduler::GetTasksCount() const
+{
+	return static_cast<unsigned>( tasks.size() );
+}
+
+unsigned CScheduler::GetThreadsCount() const
+{
+	return threadsCount;
+}
+
+double CScheduler::GetWallTime() const
+{
+	return wallTime;
+}
+
+// A task is owned by the thread that took it from the queue until it is put back, so only the queue, the
+// pending input and the waiting flags are touched under the mutex. The work is over once the queue is empty
+// and no slice is running that could put a task back.
+void CScheduler::work()
+{
+	std::unique_lock<std::mutex> lock( mutex );
+	for( ;; ) {
+		changed.wait( lock, [this] { return !ready.empty() || runningCount == 0; } );
+		if( ready.empty() ) {
+			changed.notify_all();
+			return;
+		}
+		const unsigned index = ready.front();
+		ready.pop_front();
+		CTask& task = *tasks[index];
+		std::string input;
+		input.swap( task.Pending );
+		const bool isInputClosed = task.IsPendingClosed;
+		++runningCount;
+		lock.unlock();
+
+		runSlice( task, input, isInputClosed );
+
+		lock.lock();
+		--runningCount;
+		if( task.Result.Status == CVirtualMachine::TStatus::BudgetExhausted ) {
+			ready.push_back( index );
+		} else if( task.Result.Status == CVirtualMachine::TStatus::WaitingForInput ) {
+			if( !task.Pending.empty() || task.IsPendingClosed != isInputClosed ) {
+				ready.push_back( index );
+			} else {
+				task.IsWaiting = true;
+			}
+		}
+		changed.notify_all();
+	}
+}
+
+void CScheduler::runSlice( CTask& task, const std::string& input, bool isInputClosed )
+{
+	CScheduledResult& result = task.Result;
+	auto start = std::chrono::steady_clock::now();
+	if( task.VirtualMachine == nullptr ) {
+		task.VirtualMachine.reset( new CVirtualMachine( core ) );
+		task.VirtualMachine->SetOutput( task.Output, COutput::TFlushPolicy::Exit );
+		try {
+			task.VirtualMachine->Load( task.PathToBinaryFile );
+		} catch( const std::exception& exception ) {
+			result.Status = CVirtualMachine::TStatus::Trapped;
+			result.Error = exception.what();
+			task.VirtualMachine.reset();
+			return;
+		}
+	}
+	CVirtualMachine& virtualMachine = *task.VirtualMachine;
+	virtualMachine.AppendInput( input );
+	if( isInputClosed ) {
+		virtualMachine.CloseInput();
+	}
+	result.Status = virtualMachine.Run( quantum );
+	auto finish = std::chrono::steady_clock::now();
+	result.Seconds += std::chrono::duration<double>( finish - start ).count();
+	result.ExecutedCount = virtualMachine.GetExecutedCount();
+	++result.SlicesCount;
+	result.Output = task.Output.str();
+	if( result.Status == CVirtualMachine::TStatus::Exited || result.Status == CVirtualMachine::TStatus::Trapped ) {
+		result.Error = virtualMachine.GetError();
+		task.VirtualMachine.reset();
+	}
+}
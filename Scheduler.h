@@ -0,0 +1,70 @@
+#pragma once
+
+#include "VirtualMachine.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+struct CScheduledResult {
+	CVirtualMachine::TStatus Status = CVirtualMachine::TStatus::BudgetExhausted;
+	std::string Output;
+	// Message of the error that trapped the program.
+	std::string Error;
+	unsigned long long ExecutedCount = 0;
+	unsigned long long SlicesCount = 0;
+	double Seconds = 0;
+};
+
+// Time-slices many programs over a pool of threads. Every task owns a virtual machine that is loaded on its
+// first slice and released once the program exits or traps; a slice runs it for a quantum of commands. Tasks
+// take turns in one FIFO queue, so each gets the same quantum in order no matter how long it runs. A task
+// waiting for input leaves the queue until Feed gives it more, which may also be done from another thread
+// while Run is going on.
+class CScheduler {
+
+public:
+	explicit CScheduler( unsigned _threadsCount = 0, unsigned long long _quantum = 1 << 16,
+		CVirtualMachine::TCore _core = CVirtualMachine::TCore::Decoded );
+	CScheduler( const CScheduler& ) = delete;
+	CScheduler& operator=( const CScheduler& ) = delete;
+
+	// Returns the id of the task. Unless the input is closed, more of it is expected from Feed.
+	unsigned Add( const std::string& pathToBinaryFile, const std::string& input, bool isInputClosed = true );
+	void Feed( unsigned task, const std::string& data, bool isLast );
+	// Returns when every task has exited, trapped or waits for input that has not been fed.
+	void Run();
+	// Valid between runs.
+	const CScheduledResult& GetResult( unsigned task ) const;
+	unsigned GetTasksCount() const;
+	unsigned GetThreadsCount() const;
+	double GetWallTime() const;
+
+private:
+	struct CTask {
+		std::string PathToBinaryFile;
+		// Input fed since the last slice, guarded by the mutex of the scheduler.
+		std::string Pending;
+		bool IsPendingClosed = false;
+		bool IsWaiting = false;
+		std::unique_ptr<CVirtualMachine> VirtualMachine;
+		std::ostringstream Output;
+		CScheduledResult Result;
+	};
+
+	unsigned threadsCount;
+	unsigned long long quantum;
+	CVirtualMachine::TCore core;
+	double wallTime = 0;
+	std::deque<std::unique_ptr<CTask>> tasks;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<unsigned> ready;
+	unsigned runningCount = 0;
+
+	void work();
+	void runSlice( CTask& task, const std::string& input, bool isInputClosed );
+};
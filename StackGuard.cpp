@@ -0,0 +1,84 @@
+#include "StackGuard.h"
+
+#include <mutex>
+
+#ifdef VM_HAS_STACK_GUARD
+namespace {
+
+thread_local CStackGuard* activeGuard = nullptr;
+struct sigaction previousAction;
+
+}
+#endif
+
+CStackGuard::CStackGuard( const void* _begin, size_t _size ) :
+	begin( static_cast<const char*>( _begin ) ),
+	size( _begin == nullptr ? 0 : _size ),
+	previous( nullptr )
+{
+#ifdef VM_HAS_STACK_GUARD
+	install();
+	previous = activeGuard;
+	activeGuard = this;
+#endif
+}
+
+CStackGuard::~CStackGuard()
+{
+#ifdef VM_HAS_STACK_GUARD
+	activeGuard = previous;
+#endif
+}
+
+bool CStackGuard::IsSupported()
+{
+#ifdef VM_HAS_STACK_GUARD
+	return true;
+#else
+	return false;
+#endif
+}
+
+size_t CStackGuard::GetFaultOffset() const
+{
+	return fault == nullptr ? 0 : static_cast<size_t>( fault - begin );
+}
+
+void CStackGuard::install()
+{
+#ifdef VM_HAS_STACK_GUARD
+	static std::once_flag installed;
+	std::call_once( installed, [] ()
+	{
+		struct sigaction action = {};
+		action.sa_sigaction = &CStackGuard::handle;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset( &action.sa_mask );
+		sigaction( SIGSEGV, &action, &previousAction );
+	} );
+#endif
+}
+
+#ifdef VM_HAS_STACK_GUARD
+// A fault outside the guard goes to the previous handler; with the default one, it is restored and the
+// faulting instruction runs again to end the process as it would have without the guard.
+void CStackGuard::handle( int signal, siginfo_t* info, void* context )
+{
+	CStackGuard* guard = activeGuard;
+	const char* address = static_cast<const char*>( info->si_addr );
+	if( guard != nullptr && address >= guard->begin && address < guard->begin + guard->size ) {
+		guard->fault = address;
+		siglongjmp( guard->Jump, 1 );
+	}
+	if( ( previousAction.sa_flags & SA_SIGINFO ) != 0 ) {
+		previousAction.sa_sigaction( signal, info, context );
+	} else if( previousAction.sa_handler != SIG_DFL && previousAction.sa_handler != SIG_IGN ) {
+		previousAction.sa_handler( signal );
+	} else {
+		struct sigaction action = {};
+		action.sa_handler = SIG_DFL;
+		sigemptyset( &action.sa_mask );
+		sigaction( SIGSEGV, &action, nullptr );
+	}
+}
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#include <setjmp.h>
+#include <signal.h>
+#define VM_HAS_STACK_GUARD
+#endif
+
+// Turns a fault in the guard region behind a memory image into a jump back to the point the run was started
+// from. A scope marks the guard of the current thread as active; the SIGSEGV handler, installed once, jumps
+// to the scope's buffer when the faulting address lies in that guard and leaves any other fault to the
+// handler installed before it.
+//
+// The jump skips the frames of the dispatch loop without unwinding them, so the cores keep nothing there that
+// needs to be destroyed; the caller of sigsetjmp throws the error once it is back.
+class CStackGuard {
+
+public:
+	CStackGuard( const void* _begin, size_t _size );
+	CStackGuard( const CStackGuard& ) = delete;
+	CStackGuard& operator=( const CStackGuard& ) = delete;
+	~CStackGuard();
+
+	static bool IsSupported();
+	// Offset of the faulting address from the start of the guard, valid after the jump.
+	size_t GetFaultOffset() const;
+
+#ifdef VM_HAS_STACK_GUARD
+	sigjmp_buf Jump;
+#endif
+
+private:
+	const char* begin;
+	size_t size;
+	const char* volatile fault = nullptr;
+	CStackGuard* previous;
+
+	static void install();
+#ifdef VM_HAS_STACK_GUARD
+	static void handle( int signal, siginfo_t* info, void* context );
+#endif
+};
@@ -0,0 +1,231 @@
+#include "Exception.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+CTrace::CTrace( TMode _mode, const std::string& _path ) :
+	mode( _mode ),
+	path( _path ),
+	published( 0 ),
+	saved( 0 ),
+	isFinishing( false )
+{
+}
+
+CTrace::~CTrace()
+{
+	Finish();
+}
+
+CTrace::TMode CTrace::GetMode() const
+{
+	return mode;
+}
+
+void CTrace::Start()
+{
+	Finish();
+	previous = 0;
+	branchesCount = 0;
+	inputsCount = 0;
+	const unsigned header[] = { Magic, Version };
+	if( mode == TMode::Record ) {
+		output.open( path, std::ios::out | std::ios::binary | std::ios::trunc );
+		if( !output.is_open() ) {
+			throw CInvalidFile( "CTrace::Start::InvalidFile - Cannot create trace file." );
+		}
+		output.write( reinterpret_cast<const char*>( header ), sizeof( header ) );
+		ring.resize( ringSize );
+		head = 0;
+		publishedHead = 0;
+		freeEnd = ringSize;
+		published.store( 0, std::memory_order_relaxed );
+		saved.store( 0, std::memory_order_relaxed );
+		isFinishing.store( false, std::memory_order_relaxed );
+		writer = std::thread( &CTrace::write, this );
+		return;
+	}
+	source.open( path, std::ios::in | std::ios::binary );
+	unsigned read[2] = {};
+	if( !source.is_open() || !source.read( reinterpret_cast<char*>( read ), sizeof( read ) )
+		|| read[0] != header[0] || read[1] != header[1] )
+	{
+		source.close();
+		throw CInvalidFile( "CTrace::Start::InvalidFile - Cannot read trace file." );
+	}
+	buffer.resize( readSize );
+	position = 0;
+	end = 0;
+}
+
+void CTrace::Branch( unsigned ip )
+{
+	++branchesCount;
+	const unsigned distance = zigzag( static_cast<int>( ip - previous - 3 ) );
+	if( mode == TMode::Record ) {
+		put( static_cast<unsigned long long>( distance ) << 1 );
+	} else {
+		const unsigned long long value = get();
+		if( ( value & 1 ) != 0 ) {
+			diverge( "a read, got a transfer to ip " + std::to_string( ip ) );
+		}
+		const unsigned expected = previous + 3 + static_cast<unsigned>( unzigzag( static_cast<unsigned>( value >> 1 ) ) );
+		if( expected != ip ) {
+			diverge( "a transfer to ip " + std::to_string( expected ) + ", got one to ip " + std::to_string( ip ) );
+		}
+	}
+	previous = ip;
+}
+
+unsigned CTrace::Read( CInput& input )
+{
+	++inputsCount;
+	if( mode == TMode::Record ) {
+		const unsigned number = input.ReadNumber();
+		put( ( static_cast<unsigned long long>( number ) << 1 ) | 1 );
+		return number;
+	}
+	const unsigned long long value = get();
+	if( ( value & 1 ) == 0 ) {
+		diverge( "a transfer, got a read" );
+	}
+	return static_cast<unsigned>( value >> 1 );
+}
+
+void CTrace::Exit()
+{
+	if( mode == TMode::Record || !source.is_open() ) {
+		return;
+	}
+	if( position != end || source.peek() != std::char_traits<char>::eof() ) {
+		const unsigned long long value = get();
+		diverge( ( value & 1 ) != 0 ? "a read, got the exit" : "a transfer, got the exit" );
+	}
+}
+
+// Saves everything recorded so far, also when the run stopped with an error, which is when the trace is
+// needed most.
+void CTrace::Finish()
+{
+	if( writer.joinable() ) {
+		publish();
+		isFinishing.store( true, std::memory_order_release );
+		writer.join();
+		output.close();
+	}
+	if( source.is_open() ) {
+		source.close();
+	}
+}
+
+unsigned long long CTrace::GetBranchesCount() const
+{
+	return branchesCount;
+}
+
+unsigned long long CTrace::GetInputsCount() const
+{
+	return inputsCount;
+}
+
+void CTrace::put( unsigned long long value )
+{
+	if( head + maxEventSize > freeEnd ) {
+		waitForSpace();
+	}
+	do {
+		const unsigned char low = static_cast<unsigned char>( value & 0x7F );
+		value >>= 7;
+		ring[head++ & ( ringSize - 1 )] = value != 0 ? low | 0x80 : low;
+	} while( value != 0 );
+	if( head - publishedHead >= publishSize ) {
+		publish();
+	}
+}
+
+void CTrace::publish()
+{
+	published.store( head, std::memory_order_release );
+	publishedHead = head;
+}
+
+void CTrace::waitForSpace()
+{
+	publish();
+	for( ;; ) {
+		freeEnd = saved.load( std::memory_order_acquire ) + ringSize;
+		if( head + maxEventSize <= freeEnd ) {
+			return;
+		}
+		std::this_thread::yield();
+	}
+}
+
+// Runs on the writer thread. The finishing flag is read before the published position, so the last pass
+// sees everything published before Finish set the flag.
+void CTrace::write()
+{
+	size_t done = 0;
+	for( ;; ) {
+		const bool isLast = isFinishing.load( std::memory_order_acquire );
+		const size_t available = published.load( std::memory_order_acquire );
+		if( available == done ) {
+			if( isLast ) {
+				break;
+			}
+			std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+			continue;
+		}
+		const size_t first = done & ( ringSize - 1 );
+		const size_t count = available - done;
+		const size_t tail = std::min( count, ringSize - first );
+		output.write( reinterpret_cast<const char*>( ring.data() + first ), static_cast<std::streamsize>( tail ) );
+		output.write( reinterpret_cast<const char*>( ring.data() ), static_cast<std::streamsize>( count - tail ) );
+		done = available;
+		saved.store( done, std::memory_order_release );
+	}
+	output.flush();
+}
+
+unsigned long long CTrace::get()
+{
+	unsigned long long value = 0;
+	for( unsigned shift = 0; shift < 64; shift += 7 ) {
+		const unsigned char byte = getByte();
+		value |= static_cast<unsigned long long>( byte & 0x7F ) << shift;
+		if( ( byte & 0x80 ) == 0 ) {
+			return value;
+		}
+	}
+	throw CInvalidFile( "CTrace::get::InvalidFile - Invalid event in trace file." );
+}
+
+unsigned char CTrace::getByte()
+{
+	if( position == end ) {
+		source.read( reinterpret_cast<char*>( buffer.data() ), static_cast<std::streamsize>( buffer.size() ) );
+		position = 0;
+		end = static_cast<size_t>( source.gcount() );
+		if( end == 0 ) {
+			diverge( "the run to end, as the trace does" );
+		}
+	}
+	return buffer[position++];
+}
+
+void CTrace::diverge( const std::string& what ) const
+{
+	throw CInvalidFile( "CTrace::Replay::InvalidFile - The run departs from the trace at event "
+		+ std::to_string( branchesCount + inputsCount ) + ": expected " + what + "." );
+}
+
+unsigned CTrace::zigzag( int value )
+{
+	return ( static_cast<unsigned>( value ) << 1 ) ^ static_cast<unsigned>( value >> 31 );
+}
+
+int CTrace::unzigzag( unsigned value )
+{
+	return static_cast<int>( value >> 1 ) ^ -static_cast<int>( value & 1 );
+}
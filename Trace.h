@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Input.h"
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Execution trace of a run: every control transfer made by if, call and return, and every number read.
+// The virtual machine is deterministic apart from its input, so a recorded trace is enough to run the same
+// program again: on replay numbers are taken from the trace, and each transfer is checked against it, so the
+// first point where a run departs from the recorded one is reported.
+//
+// The file starts with Magic and Version words and is followed by events encoded as LEB128 varints with the
+// kind in the lowest bit: a transfer stores the zigzagged distance of its target from the command after the
+// previous target, an input stores the number. Not taken branches and loops stay within one or two bytes.
+//
+// Recording writes the encoded events into a ring buffer and publishes them in pieces; a writer thread saves
+// what is published to the file and frees it. The two sides only share the published and the saved
+// positions, and the run waits for the writer only when the ring is full.
+class CTrace {
+
+public:
+	enum class TMode {
+		Record,
+		Replay
+	};
+
+	static const unsigned Magic = 0x52544D56;
+	static const unsigned Version = 1;
+
+	CTrace( TMode _mode, const std::string& _path );
+	CTrace( const CTrace& ) = delete;
+	CTrace& operator=( const CTrace& ) = delete;
+	~CTrace();
+
+	TMode GetMode() const;
+	void Start();
+	// Called with the ip a control transfer has landed on.
+	void Branch( unsigned ip );
+	// Number for the read command: taken from the input and recorded, or taken from the trace.
+	unsigned Read( CInput& input );
+	// Called when the program exits; on replay, events left in the trace are a departure from it.
+	void Exit();
+	void Finish();
+	unsigned long long GetBranchesCount() const;
+	unsigned long long GetInputsCount() const;
+
+private:
+	static const size_t ringSize = 1 << 20;
+	static const size_t publishSize = 1 << 14;
+	static const size_t maxEventSize = 5;
+	static const size_t readSize = 1 << 16;
+
+	TMode mode;
+	std::string path;
+	std::ofstream output;
+	std::ifstream source;
+	unsigned previous = 0;
+	unsigned long long branchesCount = 0;
+	unsigned long long inputsCount = 0;
+
+	std::vector<unsigned char> ring;
+	size_t head = 0;
+	size_t publishedHead = 0;
+	size_t freeEnd = 0;
+	std::atomic<size_t> published;
+	std::atomic<size_t> saved;
+	std::atomic<bool> isFinishing;
+	std::thread writer;
+
+	std::vector<unsigned char> buffer;
+	size_t position = 0;
+	size_t end = 0;
+
+	void put( unsigned long long value );
+	void publish();
+	void waitForSpace();
+	void write();
+	unsigned long long get();
+	unsigned char getByte();
+	void diverge( const std::string& what ) const;
+	static unsigned zigzag( int value );
+	static int unzigzag( unsigned value );
+};
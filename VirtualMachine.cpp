@@ -1,36 +1,191 @@
 #include "Exception.h"
 #include "VirtualMachine.h"
 
-#include <experimental/filesystem>
+#include <algorithm>
 #include <iostream>
 
-CVirtualMachine::CVirtualMachine()
+#if defined( __GNUC__ ) || defined( __clang__ )
+#define VM_COMPUTED_GOTO
+#endif
+
+CVirtualMachine::CVirtualMachine( TCore _core ) :
+	core( _core )
+{
+}
+
+void CVirtualMachine::SetOutput( std::ostream& stream, COutput::TFlushPolicy policy )
+{
+	output.Reset( stream, policy );
+}
+
+void CVirtualMachine::SetInput( std::istream& stream )
+{
+	input.SetStream( stream );
+}
+
+void CVirtualMachine::SetInputFile( const std::string& path )
+{
+	input.SetFile( path );
+}
+
+// Profilers are filled by every following run until they are detached with nullptr.
+void CVirtualMachine::SetProfiler( CProfiler* _profiler )
+{
+	profiler = _profiler;
+}
+
+void CVirtualMachine::SetCallProfiler( CCallProfiler* _callProfiler )
+{
+	callProfiler = _callProfiler;
+}
+
+void CVirtualMachine::SetPerfCounters( CPerfCounters* _perfCounters )
+{
+	perfCounters = _perfCounters;
+}
+
+// Memoization, like profiling, runs the program on the instrumented threaded core.
+void CVirtualMachine::SetMemoizer( CMemoizer* _memoizer )
+{
+	memoizer = _memoizer;
+}
+
+void CVirtualMachine::SetTrace( CTrace* _trace )
+{
+	trace = _trace;
+}
+
+void CVirtualMachine::SetMemorySize( unsigned _memorySize )
 {
+	if( _memorySize > CImage::MaxMemorySize ) {
+		throw CInvalidArguments( "CVirtualMachine::SetMemorySize::InvalidArguments - Memory size must not exceed "
+			+ std::to_string( CImage::MaxMemorySize ) + " words." );
+	}
+	memorySize = _memorySize;
 }
 
 void CVirtualMachine::Execute( const std::string& pathToBinaryFile )
 {
-	init( pathToBinaryFile );
-	run();
 	clear();
+	code.Load( pathToBinaryFile );
+	execute();
 }
 
-void CVirtualMachine::init( const std::string& pathToBinaryFile )
+void CVirtualMachine::ExecuteImage( const unsigned* words, size_t wordsCount )
 {
-	std::ifstream input( pathToBinaryFile, std::ios::in | std::ios::binary );
+	clear();
+	code.Load( words, wordsCount );
+	execute();
+}
 
-	if( !input.is_open() ) {
-		throw CInvalidFile( "CVirtualMachine::init::InvalidFile - Cannot open file." );
+void CVirtualMachine::execute()
+{
+	executedCount = 0;
+	std::fill( fusedCounts, fusedCounts + CDecodedProgram::FusionsCount, 0 );
+	init();
+	try {
+		run();
+	} catch( ... ) {
+		output.Flush();
+		clear();
+		throw;
 	}
+	output.Flush();
+	clear();
+}
+
+// Replaces the loaded program, if any. Errors of loading are thrown, not kept: no run has started yet.
+void CVirtualMachine::Load( const std::string& pathToBinaryFile )
+{
+	clear();
+	code.Load( pathToBinaryFile );
+	load();
+}
+
+void CVirtualMachine::LoadImage( const unsigned* words, size_t wordsCount )
+{
+	clear();
+	code.Load( words, wordsCount );
+	load();
+}
 
-	unsigned bytesCount = std::experimental::filesystem::file_size( pathToBinaryFile );
-	unsigned length = bytesCount / 4;
-	code.assign( length, 0 );
+void CVirtualMachine::load()
+{
+	executedCount = 0;
+	std::fill( fusedCounts, fusedCounts + CDecodedProgram::FusionsCount, 0 );
+	error.clear();
+	init();
+	status = TStatus::BudgetExhausted;
+	isLoaded = true;
+}
 
-	for( unsigned i = 0; i < length; ++i ) {
-		input.read( reinterpret_cast< char* >( &( code[i] ) ), sizeof( unsigned ) );
+// A program that exited or trapped is unloaded; running it again only repeats its last status.
+CVirtualMachine::TStatus CVirtualMachine::Run( unsigned long long maxInstructions )
+{
+	if( !isLoaded ) {
+		return status;
+	}
+	budget = maxInstructions;
+	status = TStatus::Exited;
+	try {
+		if( core == TCore::Jit && CJit::IsSupported() ) {
+			runGuarded( &CVirtualMachine::runDecoded<true, false> );
+		} else {
+			runGuarded( &CVirtualMachine::runDecoded<false, false> );
+		}
+	} catch( const std::exception& exception ) {
+		status = TStatus::Trapped;
+		error = exception.what();
+	}
+	budget = unlimited;
+	output.Flush();
+	if( status == TStatus::Exited || status == TStatus::Trapped ) {
+		clear();
 	}
-	input.close();
+	return status;
+}
+
+void CVirtualMachine::AppendInput( const std::string& data )
+{
+	input.Append( data );
+}
+
+void CVirtualMachine::CloseInput()
+{
+	input.Close();
+}
+
+CVirtualMachine::TStatus CVirtualMachine::GetStatus() const
+{
+	return status;
+}
+
+const std::string& CVirtualMachine::GetError() const
+{
+	return error;
+}
+
+unsigned long long CVirtualMachine::GetExecutedCount() const
+{
+	return executedCount;
+}
+
+// Counts pairs fused when the decoded cores decoded the program of the last run.
+std::string CVirtualMachine::GetFusionsReport() const
+{
+	return "pushaddr+call " + std::to_string( fusedCounts[CDecodedProgram::PushaddrCallFusion] )
+		+ ", equal+if " + std::to_string( fusedCounts[CDecodedProgram::EqualIfFusion] )
+		+ ", pop+move " + std::to_string( fusedCounts[CDecodedProgram::PopMoveFusion] );
+}
+
+void CVirtualMachine::init()
+{
+	code.Guard( memorySize );
+	if( code[0] >= code.Size() || code[1] > code.Size() ) {
+		throw CInvalidFile( "CVirtualMachine::init::InvalidFile - Instruction or stack pointer is out of memory." );
+	}
+	stackBase = code[1];
+	isDecoded = false;
 
 	commands = {
 		std::bind( &CVirtualMachine::execPrint, this ),
@@ -50,15 +205,626 @@ void CVirtualMachine::init( const std::string& pathToBinaryFile )
 	};
 }
 
+// Performance counters, when attached, are enabled around the whole dispatch loop. A recorded trace is saved
+// also when the program fails, which is when it is needed most; a replayed one must be used up at the exit.
 void CVirtualMachine::run()
+{
+	if( trace != nullptr ) {
+		trace->Start();
+	}
+	if( perfCounters != nullptr ) {
+		perfCounters->Start();
+	}
+	try {
+		runCore();
+		if( trace != nullptr ) {
+			trace->Exit();
+		}
+	} catch( ... ) {
+		stop();
+		throw;
+	}
+	stop();
+}
+
+void CVirtualMachine::stop()
+{
+	if( perfCounters != nullptr ) {
+		perfCounters->Stop( executedCount );
+	}
+	if( trace != nullptr ) {
+		trace->Finish();
+	}
+}
+
+// A profiled or memoized run always takes the threaded core: it is the fastest one that still executes the
+// program one instruction of the image at a time, and its instrumented instantiation leaves the other cores
+// untouched.
+void CVirtualMachine::runCore()
+{
+	if( profiler != nullptr || callProfiler != nullptr || ( perfCounters != nullptr && perfCounters->IsPerCommand() )
+		|| memoizer != nullptr )
+	{
+		runProfiled();
+		return;
+	}
+	if( trace != nullptr ) {
+		runGuarded( &CVirtualMachine::runDecoded<false, true> );
+		return;
+	}
+	switch( core ) {
+		case TCore::Table:
+			runGuarded( &CVirtualMachine::runTable );
+			break;
+		case TCore::Threaded:
+			runGuarded( &CVirtualMachine::runThreaded<false> );
+			break;
+		case TCore::Decoded:
+			runGuarded( &CVirtualMachine::runDecoded<false, false> );
+			break;
+		case TCore::Jit:
+			if( CJit::IsSupported() ) {
+				runGuarded( &CVirtualMachine::runDecoded<true, false> );
+			} else {
+				runGuarded( &CVirtualMachine::runDecoded<false, false> );
+			}
+			break;
+	}
+}
+
+void CVirtualMachine::runProfiled()
+{
+	if( profiler != nullptr ) {
+		profiler->Start( code.Size() );
+	}
+	if( callProfiler != nullptr ) {
+		callProfiler->Start( code );
+	}
+	if( memoizer != nullptr ) {
+		memoizer->Start( code );
+	}
+	try {
+		runGuarded( &CVirtualMachine::runThreaded<true> );
+	} catch( ... ) {
+		if( callProfiler != nullptr ) {
+			callProfiler->Finish();
+		}
+		throw;
+	}
+	if( callProfiler != nullptr ) {
+		callProfiler->Finish();
+	}
+}
+
+// Pushes carry no bound check: the memory is followed by a guard, and a push past the last word faults there
+// and comes back to sigsetjmp. Every core makes such a push with the instruction and stack pointers stored in
+// memory, so the error can tell where it happened; the count of executed commands of the run is lost.
+void CVirtualMachine::runGuarded( void ( CVirtualMachine::*runner )() )
+{
+	CStackGuard guard( code.GetGuard(), CImage::GuardSize );
+#ifdef VM_HAS_STACK_GUARD
+	if( sigsetjmp( guard.Jump, 1 ) != 0 ) {
+		throwGuardFault( guard );
+	}
+#endif
+	( this->*runner )();
+}
+
+// Pushes reach the guard at its first word; anything further is an access through an address out of memory.
+void CVirtualMachine::throwGuardFault( const CStackGuard& guard ) const
+{
+	const unsigned ip = code[0];
+	if( guard.GetFaultOffset() >= sizeof( unsigned ) ) {
+		throw CMemoryOverflow( "CVirtualMachine::runGuarded::MemoryOverflow - Access past the end of memory at ip "
+			+ std::to_string( ip ) + "." );
+	}
+	const unsigned depth = code.Size() - stackBase;
+	throw CStackOverflow( "CVirtualMachine::runGuarded::StackOverflow - Stack overflow at ip " + std::to_string( ip )
+		+ ", stack depth " + std::to_string( depth ) + " words.", ip, depth );
+}
+
+void CVirtualMachine::profileCommand( unsigned address, unsigned command )
+{
+	if( profiler != nullptr ) {
+		profiler->Count( address, command );
+	}
+	if( callProfiler != nullptr ) {
+		callProfiler->Count( address, command, code );
+	}
+	if( perfCounters != nullptr && perfCounters->IsPerCommand() ) {
+		perfCounters->Count( command );
+	}
+	if( memoizer != nullptr ) {
+		memoizer->Step( address, command, code );
+	}
+}
+
+void CVirtualMachine::runTable()
 {
 	do {
+		++executedCount;
 	} while( commands[code[code[0]]]() );
 }
 
+// Every handler jumps straight to the next one instead of returning into a common loop, so each of them
+// gets its own indirect branch and there is no std::function call or bool check per instruction.
+// The profiled variant reports every dispatched instruction to the profilers and control transfers to the
+// trace, and lets the memoizer complete calls of pure functions from its cache.
+template<bool Profiled>
+void CVirtualMachine::runThreaded()
+{
+	const unsigned* memory = code.Data();
+	unsigned long long executed = 0;
+
+	try {
+#ifdef VM_COMPUTED_GOTO
+	static void* const handlers[commandsCount] = {
+		&&print, &&read, &&push, &&pop, &&move, &&if_, &&call,
+		&&equal, &&add, &&subtract, &&pushaddr, &&return_, &&exit, &&str,
+	};
+#define VM_DISPATCH() \
+	{ \
+		++executed; \
+		unsigned command = memory[memory[0]]; \
+		if( command >= commandsCount ) { \
+			goto unknown; \
+		} \
+		if( Profiled ) { \
+			profileCommand( memory[0], command ); \
+		} \
+		goto *handlers[command]; \
+	}
+#define VM_HANDLER( name, index ) name:
+#else
+#define VM_DISPATCH() continue
+#define VM_HANDLER( name, index ) case index:
+	for( ;; ) {
+		++executed;
+		if( Profiled && memory[memory[0]] < commandsCount ) {
+			profileCommand( memory[0], memory[memory[0]] );
+		}
+		switch( memory[memory[0]] ) {
+#endif
+
+	VM_DISPATCH();
+
+	VM_HANDLER( print, 0 )
+		execPrint();
+		VM_DISPATCH();
+	VM_HANDLER( read, 1 )
+		execRead();
+		VM_DISPATCH();
+	VM_HANDLER( push, 2 )
+		execPush();
+		VM_DISPATCH();
+	VM_HANDLER( pop, 3 )
+		execPop();
+		VM_DISPATCH();
+	VM_HANDLER( move, 4 )
+		execMove();
+		VM_DISPATCH();
+	VM_HANDLER( if_, 5 )
+		execIf();
+		if( Profiled && trace != nullptr ) {
+			trace->Branch( code[0] );
+		}
+		VM_DISPATCH();
+	VM_HANDLER( call, 6 )
+		if( Profiled && memoizer != nullptr && memoizer->Call( code ) ) {
+			if( callProfiler != nullptr ) {
+				callProfiler->Return();
+			}
+			VM_DISPATCH();
+		}
+		execCall();
+		if( Profiled && trace != nullptr ) {
+			trace->Branch( code[0] );
+		}
+		VM_DISPATCH();
+	VM_HANDLER( equal, 7 )
+		execEqual();
+		VM_DISPATCH();
+	VM_HANDLER( add, 8 )
+		execAdd();
+		VM_DISPATCH();
+	VM_HANDLER( subtract, 9 )
+		execSubtract();
+		VM_DISPATCH();
+	VM_HANDLER( pushaddr, 10 )
+		execPushaddr();
+		VM_DISPATCH();
+	VM_HANDLER( return_, 11 )
+		if( Profiled && memoizer != nullptr ) {
+			memoizer->Return( code );
+		}
+		execReturn();
+		if( Profiled && trace != nullptr ) {
+			trace->Branch( code[0] );
+		}
+		VM_DISPATCH();
+	VM_HANDLER( str, 13 )
+		execStr();
+		VM_DISPATCH();
+	VM_HANDLER( exit, 12 )
+		executedCount = executed;
+		return;
+
+#ifdef VM_COMPUTED_GOTO
+unknown:
+#else
+		default:
+			break;
+		}
+		break;
+	}
+#endif
+	throw CInvalidFile( "CVirtualMachine::runThreaded::InvalidFile - Unknown command." );
+	} catch( ... ) {
+		executedCount = executed;
+		throw;
+	}
+
+#undef VM_HANDLER
+#undef VM_DISPATCH
+}
+
+// Same dispatch as runThreaded, but over the decoded program: operand kinds are known from the decoded entry,
+// so the handlers never look at the tags of command words. Commands that were not specialized or were
+// overwritten at runtime go through execRaw, which also keeps the decoded program in sync with the memory.
+//
+// The instruction pointer, the stack pointer and the registers live in locals for the whole run and are
+// written back to code[0..9] only when something may look at them as memory: before the raw path (which is
+// also taken by pushes and pops reaching below the decode limit and by pushes at the end of memory), on
+// indirect register values, on exit and when a command throws.
+//
+// The tiered variant additionally hands control to the JIT every time it lands on a new basic block; the traced
+// one reports every control transfer to the trace.
+//
+// A run started by Run stops at the first control transfer or undecoded command after its budget is spent, and
+// in front of a read that has no input yet; the state is stored, so the next run goes on from there with the
+// same decoded program. Undecoded commands may be branches of a program that overwrote its code.
+template<bool Tiered, bool Traced>
+void CVirtualMachine::runDecoded()
+{
+	if( !isDecoded ) {
+		decoded.Decode( code, code[1] );
+		for( unsigned i = 0; i < CDecodedProgram::FusionsCount; ++i ) {
+			fusedCounts[i] = decoded.GetFusedCount( static_cast<CDecodedProgram::TFusion>( i ) );
+		}
+		if( Tiered ) {
+			jit.Init( decoded, code );
+		}
+		isDecoded = true;
+	}
+	unsigned* memory = code.Data();
+	const CDecodedCommand* program = decoded.Data();
+	const CDecodedCommand* command = nullptr;
+	const unsigned limit = decoded.GetLimit();
+	const unsigned stackSize = code.Size() - limit;
+	const unsigned long long budget = this->budget;
+	unsigned long long executed = 0;
+	unsigned ip;
+	unsigned sp;
+	unsigned registers[registersCount];
+
+#define VM_LOAD_STATE() \
+	{ \
+		ip = memory[0]; \
+		sp = memory[1]; \
+		std::copy( memory + firstRegister, memory + resIndex + 1, registers ); \
+	}
+#define VM_STORE_STATE() storeState( ip, sp, registers )
+#define VM_REGISTER( address ) registers[( address ) - firstRegister]
+#define VM_VALUE( address ) \
+	( isInteger( VM_REGISTER( address ) ) ? VM_REGISTER( address ) - integerShift : \
+		( VM_STORE_STATE(), getInteger( VM_REGISTER( address ) ) ) )
+#define VM_SUSPEND( reason ) \
+	{ \
+		VM_STORE_STATE(); \
+		executedCount += executed; \
+		status = reason; \
+		return; \
+	}
+#define VM_WAIT_FOR_INPUT() \
+	if( !input.IsReady() ) { \
+		--executed; \
+		VM_SUSPEND( TStatus::WaitingForInput ); \
+	}
+#define VM_RAW() \
+	{ \
+		if( memory[ip] == 1 ) { \
+			VM_WAIT_FOR_INPUT(); \
+		} \
+		VM_STORE_STATE(); \
+		bool proceed = execRaw(); \
+		VM_LOAD_STATE(); \
+		if( !proceed ) { \
+			executedCount += executed; \
+			return; \
+		} \
+		if( executed >= budget ) { \
+			VM_SUSPEND( TStatus::BudgetExhausted ); \
+		} \
+		VM_DISPATCH(); \
+	}
+
+#ifdef VM_COMPUTED_GOTO
+	static void* const handlers[CDecodedProgram::OperationsCount] = {
+		&&Raw, &&PrintImmediate, &&PrintRegister, &&Read, &&PushImmediate, &&PushRegister, &&Pop,
+		&&MoveImmediate, &&MoveRegister, &&IfImmediate, &&IfRegister, &&Call,
+		&&EqualImmediateImmediate, &&EqualImmediateRegister, &&EqualRegisterImmediate, &&EqualRegisterRegister,
+		&&AddImmediateImmediate, &&AddImmediateRegister, &&AddRegisterImmediate, &&AddRegisterRegister,
+		&&SubtractImmediateImmediate, &&SubtractImmediateRegister, &&SubtractRegisterImmediate,
+		&&SubtractRegisterRegister, &&Pushaddr, &&Return, &&Exit, &&Str,
+		&&PushaddrCall, &&EqualIfImmediateImmediate, &&EqualIfImmediateRegister, &&EqualIfRegisterImmediate,
+		&&EqualIfRegisterRegister, &&PopMove,
+	};
+#define VM_DISPATCH() \
+	{ \
+		++executed; \
+		command = &program[ip]; \
+		goto *handlers[command->Operation]; \
+	}
+#define VM_HANDLER( name ) name:
+#else
+#define VM_DISPATCH() continue
+#define VM_HANDLER( name ) case CDecodedProgram::name:
+#endif
+#define VM_BRANCH() \
+	{ \
+		if( Traced ) { \
+			trace->Branch( ip ); \
+		} \
+		if( executed >= budget ) { \
+			VM_SUSPEND( TStatus::BudgetExhausted ); \
+		} \
+		if( Tiered ) { \
+			CJit::TBlock block; \
+			while( ( block = jit.Prepare( ip, decoded ) ) != nullptr ) { \
+				VM_STORE_STATE(); \
+				jit.SetBudget( budget - executed ); \
+				bool bailed = jit.Execute( block, memory ); \
+				executed += jit.TakeExecutedCount(); \
+				VM_LOAD_STATE(); \
+				if( bailed ) { \
+					break; \
+				} \
+				if( executed >= budget ) { \
+					VM_SUSPEND( TStatus::BudgetExhausted ); \
+				} \
+			} \
+		} \
+		VM_DISPATCH(); \
+	}
+#define VM_PUSH( value ) \
+	{ \
+		if( sp - limit >= stackSize ) { \
+			VM_RAW(); \
+		} \
+		unsigned pushed = value; \
+		memory[sp++] = pushed; \
+		ip += 3; \
+		VM_DISPATCH(); \
+	}
+#define VM_BINARY( name, first, second, operation ) \
+	VM_HANDLER( name ) \
+	{ \
+		unsigned argument1 = first; \
+		unsigned argument2 = second; \
+		operation; \
+		ip += 3; \
+		VM_DISPATCH(); \
+	}
+#define VM_EQUAL_IF( name, first, second ) \
+	VM_HANDLER( name ) \
+	{ \
+		bool isEqual = ( first ) == ( second ); \
+		VM_REGISTER( resIndex ) = castToCodeData( isEqual ); \
+		ip = isEqual ? command->Argument3 : ip + 6; \
+		++executed; \
+		VM_BRANCH(); \
+	}
+#define VM_BINARY_ALL( name, operation ) \
+	VM_BINARY( name##ImmediateImmediate, command->Argument1, command->Argument2, operation ) \
+	VM_BINARY( name##ImmediateRegister, command->Argument1, VM_VALUE( command->Argument2 ), operation ) \
+	VM_BINARY( name##RegisterImmediate, VM_VALUE( command->Argument1 ), command->Argument2, operation ) \
+	VM_BINARY( name##RegisterRegister, VM_VALUE( command->Argument1 ), VM_VALUE( command->Argument2 ), operation )
+
+	VM_LOAD_STATE();
+	try {
+#ifndef VM_COMPUTED_GOTO
+	for( ;; ) {
+		++executed;
+		command = &program[ip];
+		switch( command->Operation ) {
+#else
+	VM_DISPATCH();
+#endif
+
+	VM_HANDLER( Raw )
+		VM_RAW();
+	VM_HANDLER( PrintImmediate )
+		output.WriteNumber( command->Argument1 );
+		output.EndLine();
+		ip += 3;
+		VM_DISPATCH();
+	VM_HANDLER( PrintRegister )
+		output.WriteNumber( VM_VALUE( command->Argument1 ) );
+		output.EndLine();
+		ip += 3;
+		VM_DISPATCH();
+	VM_HANDLER( Read )
+	{
+		VM_WAIT_FOR_INPUT();
+		unsigned number = readNumber();
+		VM_REGISTER( resIndex ) = castToCodeData( number );
+		ip += 3;
+		VM_DISPATCH();
+	}
+	VM_HANDLER( PushImmediate )
+		VM_PUSH( castToCodeData( command->Argument1 ) );
+	VM_HANDLER( PushRegister )
+		VM_PUSH( castToCodeData( VM_VALUE( command->Argument1 ) ) );
+	VM_HANDLER( Pop )
+		if( sp <= limit ) {
+			VM_RAW();
+		}
+		VM_REGISTER( resIndex ) = memory[--sp];
+		memory[sp] = 0;
+		ip += 3;
+		VM_DISPATCH();
+	VM_HANDLER( MoveImmediate )
+		VM_REGISTER( command->Argument2 ) = castToCodeData( command->Argument1 );
+		ip += 3;
+		VM_DISPATCH();
+	VM_HANDLER( MoveRegister )
+		VM_REGISTER( command->Argument2 ) = castToCodeData( VM_VALUE( command->Argument1 ) );
+		ip += 3;
+		VM_DISPATCH();
+	VM_HANDLER( IfImmediate )
+		ip = command->Argument1 == 0 ? ip + 3 : command->Argument3;
+		VM_BRANCH();
+	VM_HANDLER( IfRegister )
+		ip = VM_VALUE( command->Argument1 ) == 0 ? ip + 3 : command->Argument3;
+		VM_BRANCH();
+	VM_HANDLER( Call )
+		ip = command->Argument2;
+		VM_BRANCH();
+	VM_BINARY_ALL( Equal, VM_REGISTER( resIndex ) = castToCodeData( argument1 == argument2 ) )
+	VM_BINARY_ALL( Add, VM_REGISTER( resIndex ) = castToCodeData( argument1 + argument2 ) )
+	VM_BINARY_ALL( Subtract,
+		if( argument1 < argument2 ) {
+			throw CInvalidArguments( "CVirtualMachine::execSubtract::CInvalidArguments - Minuend is less than subtrahend." );
+		}
+		VM_REGISTER( resIndex ) = castToCodeData( argument1 - argument2 ) )
+	VM_HANDLER( Pushaddr )
+		VM_PUSH( castToCodeData( ip + 6 ) );
+	VM_HANDLER( Return )
+		ip = VM_VALUE( resIndex );
+		VM_BRANCH();
+	VM_HANDLER( Str )
+		printString( command->Argument1 );
+		ip += 3;
+		VM_DISPATCH();
+	VM_HANDLER( PushaddrCall )
+		if( sp - limit >= stackSize ) {
+			VM_RAW();
+		}
+		memory[sp++] = castToCodeData( ip + 6 );
+		ip = command->Argument2;
+		++executed;
+		VM_BRANCH();
+	VM_EQUAL_IF( EqualIfImmediateImmediate, command->Argument1, command->Argument2 )
+	VM_EQUAL_IF( EqualIfImmediateRegister, command->Argument1, VM_VALUE( command->Argument2 ) )
+	VM_EQUAL_IF( EqualIfRegisterImmediate, VM_VALUE( command->Argument1 ), command->Argument2 )
+	VM_EQUAL_IF( EqualIfRegisterRegister, VM_VALUE( command->Argument1 ), VM_VALUE( command->Argument2 ) )
+	VM_HANDLER( PopMove )
+		if( sp <= limit ) {
+			VM_RAW();
+		}
+		VM_REGISTER( resIndex ) = memory[--sp];
+		memory[sp] = 0;
+		VM_REGISTER( command->Argument2 ) = castToCodeData( VM_VALUE( resIndex ) );
+		ip += 6;
+		++executed;
+		VM_DISPATCH();
+	VM_HANDLER( Exit )
+		VM_STORE_STATE();
+		executedCount += executed;
+		return;
+
+#ifndef VM_COMPUTED_GOTO
+		default:
+			break;
+		}
+		break;
+	}
+	throw CInvalidFile( "CVirtualMachine::runDecoded::InvalidFile - Unknown decoded command." );
+#endif
+	} catch( ... ) {
+		VM_STORE_STATE();
+		executedCount += executed;
+		throw;
+	}
+
+#undef VM_BINARY_ALL
+#undef VM_EQUAL_IF
+#undef VM_BINARY
+#undef VM_PUSH
+#undef VM_BRANCH
+#undef VM_HANDLER
+#undef VM_DISPATCH
+#undef VM_RAW
+#undef VM_WAIT_FOR_INPUT
+#undef VM_SUSPEND
+#undef VM_VALUE
+#undef VM_REGISTER
+#undef VM_STORE_STATE
+#undef VM_LOAD_STATE
+}
+
+void CVirtualMachine::storeState( unsigned ip, unsigned sp, const unsigned* registers )
+{
+	code[0] = ip;
+	code[1] = sp;
+	std::copy( registers, registers + registersCount, code.Data() + firstRegister );
+}
+
+// Executes the command at ip with the original handlers and drops decoded entries covering the word it writes.
+bool CVirtualMachine::execRaw()
+{
+	static bool ( CVirtualMachine::* const handlers[commandsCount] )() = {
+		&CVirtualMachine::execPrint, &CVirtualMachine::execRead, &CVirtualMachine::execPush,
+		&CVirtualMachine::execPop, &CVirtualMachine::execMove, &CVirtualMachine::execIf,
+		&CVirtualMachine::execCall, &CVirtualMachine::execEqual, &CVirtualMachine::execAdd,
+		&CVirtualMachine::execSubtract, &CVirtualMachine::execPushaddr, &CVirtualMachine::execReturn,
+		&CVirtualMachine::execExit, &CVirtualMachine::execStr,
+	};
+
+	const unsigned command = code[code[0]];
+	if( command >= commandsCount ) {
+		throw CInvalidFile( "CVirtualMachine::execRaw::InvalidFile - Unknown command." );
+	}
+	unsigned written = resIndex;
+	switch( command ) {
+		case 2: // push
+		case 10: // pushaddr
+			written = code[1];
+			break;
+		case 3: // pop
+			written = code[1] - 1;
+			break;
+		case 4: // move
+			written = code[code[0] + 2];
+			break;
+	}
+	bool proceed = ( this->*handlers[command] )();
+	invalidate( written );
+	if( trace != nullptr && ( command == 5 || command == 6 || command == 11 ) ) {
+		trace->Branch( code[0] );
+	}
+	return proceed;
+}
+
+// A written label or function slot also moves the branches resolved from it, and compiled blocks ending in
+// them are dropped to be compiled again with the new target.
+void CVirtualMachine::invalidate( unsigned address )
+{
+	decoded.Invalidate( address );
+	if( core == TCore::Jit ) {
+		jit.Invalidate( address );
+	}
+	for( unsigned branch : decoded.Retarget( address, code[address] ) ) {
+		if( core == TCore::Jit ) {
+			jit.Invalidate( branch );
+		}
+	}
+}
+
 bool CVirtualMachine::execPrint()
 {
-	std::cout << getInteger( code[code[0] + 1] ) << std::endl;
+	output.WriteNumber( getInteger( code[code[0] + 1] ) );
+	output.EndLine();
 	code[0] += 3;
 	return true;
 }
@@ -78,13 +844,17 @@ bool CVirtualMachine::isInteger( unsigned number )
 
 bool CVirtualMachine::execRead()
 {
-	unsigned number;
-	std::cin >> number;
-	code[resIndex] = castToCodeData( number );
+	code[resIndex] = castToCodeData( readNumber() );
 	code[0] += 3;
 	return true;
 }
 
+unsigned CVirtualMachine::readNumber()
+{
+	output.BeforeRead();
+	return trace != nullptr ? trace->Read( input ) : input.ReadNumber();
+}
+
 unsigned CVirtualMachine::castToCodeData( int number )
 {
 	return number + integerShift;
@@ -174,21 +944,25 @@ bool CVirtualMachine::execExit()
 
 bool CVirtualMachine::execStr()
 {
-	for( int i = code[code[0] + 1]; ; ++i ) {
-		for( int j = 24; j >= 0; j -= 8 ) {
-			unsigned char c = ( code[i] >> j ) & 0xFF;
-			if( c == 0 ) {
-				std::cout << std::endl;
-				code[0] += 3;
-				return true;
-			}
-			std::cout << c;
-		}
+	printString( code[code[0] + 1] );
+	code[0] += 3;
+	return true;
+}
+
+void CVirtualMachine::printString( unsigned address )
+{
+	if( address < code.Size() ) {
+		output.WriteString( code.Data() + address, code.Size() - address );
 	}
+	output.EndLine();
 }
 
 void CVirtualMachine::clear()
 {
-	code.clear();
+	code.Clear();
 	commands.clear();
+	decoded.Clear();
+	jit.Clear();
+	isDecoded = false;
+	isLoaded = false;
 }
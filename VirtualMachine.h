@@ -1,29 +1,134 @@
 #pragma once
 
+#include "CallProfiler.h"
+#include "DecodedProgram.h"
+#include "Image.h"
+#include "Input.h"
+#include "Jit.h"
+#include "Memoizer.h"
+#include "Output.h"
+#include "PerfCounters.h"
+#include "Profiler.h"
+#include "StackGuard.h"
+#include "Trace.h"
+
 #include <fstream>
 #include <functional>
 #include <string>
 #include <vector>
 
+// All state of a run, including the memory image, buffers and compiled code, belongs to the instance, so
+// separate instances can execute programs on separate threads.
 class CVirtualMachine {
 
 public:
-	CVirtualMachine();
+	enum class TCore {
+		// Handlers are bound into a table of std::function and called one by one.
+		Table,
+		// Direct-threaded dispatch: computed goto when supported, switch otherwise.
+		Threaded,
+		// Threaded dispatch over a pre-decoded copy of the program with operand-specialized handlers,
+		// keeping the instruction pointer, the stack pointer and the registers in locals.
+		Decoded,
+		// Decoded core that compiles hot basic blocks to x86-64 code; same as Decoded on other targets.
+		Jit
+	};
+
+	// Why Run returned.
+	enum class TStatus {
+		Exited,
+		BudgetExhausted,
+		WaitingForInput,
+		// Stopped by an error, kept by GetError.
+		Trapped
+	};
+
+	explicit CVirtualMachine( TCore _core = TCore::Decoded );
+	CVirtualMachine( const CVirtualMachine& ) = delete;
+	CVirtualMachine& operator=( const CVirtualMachine& ) = delete;
 
+	void SetOutput( std::ostream& stream, COutput::TFlushPolicy policy = COutput::TFlushPolicy::Auto );
+	void SetInput( std::istream& stream );
+	void SetInputFile( const std::string& path );
+	void SetProfiler( CProfiler* _profiler );
+	void SetCallProfiler( CCallProfiler* _callProfiler );
+	void SetPerfCounters( CPerfCounters* _perfCounters );
+	void SetMemoizer( CMemoizer* _memoizer );
+	// A traced run records or replays its control transfers and input. It takes the decoded core without the
+	// JIT, or the threaded one if profiled.
+	void SetTrace( CTrace* _trace );
+	// Memory of the following runs has at least this many words; the part past the image is zeroed stack room.
+	void SetMemorySize( unsigned _memorySize );
 	void Execute( const std::string& pathToBinaryFile );
+	// Executes a binary file held in memory, such as one returned by CAssembler::AssemblySource.
+	void ExecuteImage( const unsigned* words, size_t wordsCount );
+	// Resumable execution on the decoded core: Load prepares a program and every Run continues it for about
+	// maxInstructions commands. The budget is checked at control transfers only, so a run may go over it by
+	// the straight-line commands up to the next one. Profilers and traces are not used.
+	void Load( const std::string& pathToBinaryFile );
+	void LoadImage( const unsigned* words, size_t wordsCount );
+	TStatus Run( unsigned long long maxInstructions );
+	// Input appended between runs; a program reading past it waits for more until the input is closed.
+	void AppendInput( const std::string& data );
+	void CloseInput();
+	TStatus GetStatus() const;
+	const std::string& GetError() const;
+	// Commands executed by the last Execute, or by all runs since the last Load.
+	unsigned long long GetExecutedCount() const;
+	std::string GetFusionsReport() const;
 
 private:
 	static const unsigned integerShift = 1 << 31;
+	static const unsigned firstRegister = 2;
 	static const unsigned resIndex = 9;
-	std::vector<unsigned> code;
+	static const unsigned registersCount = resIndex - firstRegister + 1;
+	static const unsigned commandsCount = 14;
+	static const unsigned long long unlimited = ~0ull;
+	TCore core;
+	unsigned memorySize = 0;
+	unsigned stackBase = 0;
+	bool isLoaded = false;
+	bool isDecoded = false;
+	unsigned long long budget = unlimited;
+	TStatus status = TStatus::Exited;
+	std::string error;
+	unsigned long long executedCount = 0;
+	unsigned fusedCounts[CDecodedProgram::FusionsCount] = {};
+	CImage code;
 	std::vector<std::function<bool()>> commands;
+	CDecodedProgram decoded;
+	CJit jit;
+	COutput output;
+	CInput input;
+	CProfiler* profiler = nullptr;
+	CCallProfiler* callProfiler = nullptr;
+	CPerfCounters* perfCounters = nullptr;
+	CMemoizer* memoizer = nullptr;
+	CTrace* trace = nullptr;
 
-	void init( const std::string& pathToBinaryFile );
+	void execute();
+	void load();
+	void init();
 	void run();
+	void stop();
+	void runCore();
+	void runProfiled();
+	void runGuarded( void ( CVirtualMachine::*runner )() );
+	void throwGuardFault( const CStackGuard& guard ) const;
+	void profileCommand( unsigned address, unsigned command );
+	void runTable();
+	template<bool Profiled>
+	void runThreaded();
+	template<bool Tiered, bool Traced>
+	void runDecoded();
+	void storeState( unsigned ip, unsigned sp, const unsigned* registers );
+	bool execRaw();
+	void invalidate( unsigned address );
 	bool execPrint();
 	unsigned getInteger( unsigned number ) const;
 	static bool isInteger( unsigned number );
 	bool execRead();
+	unsigned readNumber();
 	static unsigned castToCodeData( int number );
 	bool execPush();
 	bool execPop();
@@ -37,5 +142,6 @@ private:
 	bool execPushaddr();
 	bool execExit();
 	bool execStr();
+	void printString( unsigned address );
 	void clear();
-};
\ No newline at end of file
+};
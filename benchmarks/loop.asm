@@ -0,0 +1,24 @@
+strings
+.
+labels
+  loop
+  done
+.
+functions
+.
+commands
+  read
+  move res reg1
+  move 0 reg2
+  label loop
+  equal reg1 0
+  if res done
+  subtract reg1 1
+  move res reg1
+  add reg2 3
+  move res reg2
+  if 1 loop
+  label done
+  print reg2
+  exit
+.
@@ -0,0 +1,46 @@
+strings
+.
+labels
+  again
+  done
+.
+functions
+  f
+    strings
+    .
+    labels
+      skip
+    .
+    functions
+    .
+    commands
+      pop
+      move res reg7
+      pop
+      if res skip
+      move 5 reg1
+      label skip
+      push 0
+      push reg7
+      pop
+      return
+    .
+.
+commands
+  move 100 reg1
+  move 2 reg6
+  label again
+  push 1
+  pushaddr
+  call f
+  pop
+  print reg1
+  move 200 reg1
+  subtract reg6 1
+  move res reg6
+  equal reg6 0
+  if res done
+  if 1 again
+  label done
+  exit
+.
@@ -0,0 +1,13 @@
+strings
+.
+labels
+  b
+.
+functions
+.
+commands
+  pop
+  pop
+  label b
+  if 7 b
+.
@@ -0,0 +1,59 @@
+strings
+.
+labels
+  repeat
+  done
+.
+functions
+  down
+    strings
+    .
+    labels
+      base
+    .
+    functions
+    .
+    commands
+      pop
+      move res reg1
+      pop
+      move res reg2
+      push reg1
+      equal reg2 0
+      if res base
+      subtract reg2 1
+      push res
+      pushaddr
+      call down
+      pop
+      add res 1
+      move res reg2
+      pop
+      push reg2
+      return
+      label base
+      pop
+      push 0
+      return
+    .
+.
+commands
+  read
+  move res reg6
+  read
+  move res reg7
+  label repeat
+  equal reg6 0
+  if res done
+  subtract reg6 1
+  move res reg6
+  push reg7
+  pushaddr
+  call down
+  pop
+  move res reg5
+  if 1 repeat
+  label done
+  print reg5
+  exit
+.
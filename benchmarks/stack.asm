@@ -0,0 +1,40 @@
+strings
+.
+labels
+  round
+  pushes
+  pops
+  done
+.
+functions
+.
+commands
+  read
+  move res reg1
+  read
+  move res reg3
+  label round
+  equal reg1 0
+  if res done
+  subtract reg1 1
+  move res reg1
+  move reg3 reg2
+  label pushes
+  push reg2
+  subtract reg2 1
+  move res reg2
+  equal reg2 0
+  if res pops
+  if 1 pushes
+  label pops
+  pop
+  move res reg5
+  add reg2 1
+  move res reg2
+  equal reg2 reg3
+  if res round
+  if 1 pops
+  label done
+  print reg5
+  exit
+.
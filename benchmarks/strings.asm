@@ -0,0 +1,27 @@
+strings
+  first The quick brown fox jumps over the lazy dog.
+  second Pack my box with five dozen liquor jugs, then sing a song of sixpence.
+  third How vexingly quick daft zebras jump!
+.
+labels
+  loop
+  done
+.
+functions
+.
+commands
+  read
+  move res reg1
+  label loop
+  equal reg1 0
+  if res done
+  subtract reg1 1
+  move res reg1
+  str first
+  str second
+  str third
+  str second
+  if 1 loop
+  label done
+  exit
+.